@@ -2342,24 +2342,21 @@ disassembler_t::disassembler_t(const isa_parser_t *isa)
     std::reverse(chain[i].begin(), chain[i].end());
 }
 
-const disasm_insn_t* disassembler_t::probe_once(insn_t insn, size_t idx) const
-{
-  for (auto it = chain[idx].rbegin(); it != chain[idx].rend(); ++it)
-    if (*(*it) == insn)
-      return *it;
-
-  return NULL;
-}
-
 const disasm_insn_t* disassembler_t::lookup(insn_t insn) const
 {
-  if (auto p = probe_once(insn, hash(insn.bits(), MASK1)))
-    return p;
-
-  if (auto p = probe_once(insn, hash(insn.bits(), MASK2)))
-    return p;
-
-  return probe_once(insn, HASH_SIZE);
+  if (tree_stale) {
+    // Each chain is searched back-to-front.  Instructions in different hash
+    // chains can't match the same bits, except those in the last chain, which
+    // is searched last.
+    std::vector<decode_tree_t<const disasm_insn_t*>::pattern_t> patterns;
+    for (size_t i = 0; i < HASH_SIZE+1; i++)
+      for (auto it = chain[i].rbegin(); it != chain[i].rend(); ++it)
+        patterns.push_back({(*it)->get_match(), (*it)->get_mask(), *it});
+    tree.build(patterns, NULL);
+    tree_stale = false;
+  }
+
+  return tree.lookup(insn.bits() & 0xffffffff);
 }
 
 void NOINLINE disassembler_t::add_insn(disasm_insn_t* insn)
@@ -2370,6 +2367,7 @@ void NOINLINE disassembler_t::add_insn(disasm_insn_t* insn)
     HASH_SIZE;
 
   chain[idx].push_back(insn);
+  tree_stale = true;
 }
 
 disassembler_t::~disassembler_t()
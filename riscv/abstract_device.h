@@ -17,6 +17,10 @@ class abstract_device_t {
   virtual bool store(reg_t addr, size_t len, const uint8_t* bytes) = 0;
   virtual ~abstract_device_t() {}
   virtual void tick(reg_t UNUSED rtc_ticks) {}
+  // RTC ticks until the device may next change state on its own (e.g. raise
+  // an interrupt), or -1 if it has nothing scheduled.  With --idle-skip, time
+  // is fast-forwarded up to this point while every hart is waiting.
+  virtual reg_t ticks_until_event() { return reg_t(-1); }
 };
 
 // factory for devices which should show up in the DTS, and can be
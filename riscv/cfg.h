@@ -84,7 +84,13 @@ public:
       hartids(default_hartids),
       explicit_hartids(false),
       real_time_clint(default_real_time_clint),
-      trigger_count(default_trigger_count)
+      trigger_count(default_trigger_count),
+      parallel(false),
+      quantum(5000),
+      jit(false),
+      idle_skip(false),
+      stlb_sets(0),
+      stlb_ways(0)
   {}
 
   cfg_arg_t<std::pair<reg_t, reg_t>> initrd_bounds;
@@ -101,6 +107,12 @@ public:
   bool                               explicit_hartids;
   cfg_arg_t<bool>                    real_time_clint;
   reg_t                              trigger_count;
+  bool                               parallel;
+  size_t                             quantum;
+  bool                               jit;
+  bool                               idle_skip;
+  size_t                             stlb_sets;
+  size_t                             stlb_ways;
 
   size_t nprocs() const { return hartids().size(); }
   size_t max_hartid() const { return hartids().back(); }
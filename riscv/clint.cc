@@ -116,6 +116,21 @@ void clint_t::tick(reg_t rtc_ticks)
   }
 }
 
+reg_t clint_t::ticks_until_event()
+{
+  // The real-time clock follows the host, so it can't be skipped ahead.
+  if (real_time)
+    return 0;
+
+  // Software parks an unused comparator at -1, so it never fires.
+  reg_t ticks = reg_t(-1);
+  for (const auto& [hart_id, cmp] : mtimecmp) {
+    if (cmp > mtime && cmp != mtimecmp_t(-1) && sim->get_harts().count(hart_id))
+      ticks = std::min<reg_t>(ticks, cmp - mtime);
+  }
+  return ticks;
+}
+
 clint_t* clint_parse_from_fdt(const void* fdt, const sim_t* sim, reg_t* base) {
   if (fdt_parse_clint(fdt, base, "riscv,clint0") == 0)
     return new clint_t(sim,
@@ -124,6 +124,7 @@ bool pmpaddr_csr_t::unlogged_write(const reg_t val) noexcept {
   else
     return false;
   proc->get_mmu()->flush_tlb();
+  proc->get_mmu()->flush_pmp();
   return true;
 }
 
@@ -180,6 +181,19 @@ bool pmpaddr_csr_t::subset_match(reg_t addr, reg_t len) const noexcept {
   return !(is_tor ? tor_homogeneous : napot_homogeneous);
 }
 
+bool pmpaddr_csr_t::match_range(reg_t* base, reg_t* last) const noexcept {
+  if ((cfg & PMP_A) == 0) return false;
+  if ((cfg & PMP_A) == PMP_TOR) {
+    *base = tor_base_paddr();
+    *last = tor_paddr() - 1;
+    return *base < tor_paddr();
+  }
+  // NAPOT or NA4:
+  *base = tor_paddr() & napot_mask();
+  *last = *base | ~napot_mask();
+  return true;
+}
+
 bool pmpaddr_csr_t::access_ok(access_type type, reg_t mode) const noexcept {
   const bool cfgx = cfg & PMP_X;
   const bool cfgw = cfg & PMP_W;
@@ -275,6 +289,7 @@ bool pmpcfg_csr_t::unlogged_write(const reg_t val) noexcept {
     }
   }
   proc->get_mmu()->flush_tlb();
+  proc->get_mmu()->flush_pmp();
   return write_success;
 }
 
@@ -321,6 +336,7 @@ bool mseccfg_csr_t::unlogged_write(const reg_t val) noexcept {
   new_val |= (val & MSECCFG_MML);   //MML is sticky
 
   proc->get_mmu()->flush_tlb();
+  proc->get_mmu()->flush_pmp();
 
   return basic_csr_t::unlogged_write(new_val);
 }
@@ -665,6 +681,10 @@ bool misa_csr_t::unlogged_write(const reg_t val) noexcept {
   proc->set_extension_enable(EXT_ZFHMIN, new_misa & (1L << ('F' - 'A')));
   proc->set_extension_enable(EXT_ZVFH, (new_misa & (1L << ('V' - 'A'))) && proc->extension_enabled(EXT_ZFHMIN));
   proc->set_extension_enable(EXT_ZVFHMIN, new_misa & (1L << ('V' - 'A')));
+  // Decoded and translated blocks were specialized for the old set of
+  // extensions (e.g. RVE).
+  proc->select_step_loop();
+  proc->get_mmu()->flush_icache();
 
   // update the hypervisor-only bits in MEDELEG and other CSRs
   if (!new_h && prev_h) {
@@ -705,11 +725,20 @@ mip_or_mie_csr_t::mip_or_mie_csr_t(processor_t* const proc, const reg_t addr):
 }
 
 reg_t mip_or_mie_csr_t::read() const noexcept {
-  return val;
+  return __atomic_load_n(&val, __ATOMIC_RELAXED);
+}
+
+// In parallel mode, devices and other harts update mip from other threads,
+// so its read-modify-writes must not lose concurrent updates.
+static void atomic_write_with_mask(reg_t* dst, const reg_t mask, const reg_t val) noexcept {
+  reg_t old = __atomic_load_n(dst, __ATOMIC_RELAXED);
+  while (!__atomic_compare_exchange_n(dst, &old, (old & ~mask) | (val & mask),
+                                      true, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED))
+    ;
 }
 
 void mip_or_mie_csr_t::write_with_mask(const reg_t mask, const reg_t val) noexcept {
-  this->val = (this->val & ~mask) | (val & mask);
+  atomic_write_with_mask(&this->val, mask, val);
   log_write();
 }
 
@@ -723,7 +752,7 @@ mip_csr_t::mip_csr_t(processor_t* const proc, const reg_t addr):
 }
 
 void mip_csr_t::backdoor_write_with_mask(const reg_t mask, const reg_t val) noexcept {
-  this->val = (this->val & ~mask) | (val & mask);
+  atomic_write_with_mask(&this->val, mask, val);
 }
 
 reg_t mip_csr_t::write_mask() const noexcept {
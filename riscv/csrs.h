@@ -90,6 +90,9 @@ class pmpaddr_csr_t: public csr_t {
   // Does the specified range match only a proper subset of this page?
   bool subset_match(reg_t addr, reg_t len) const noexcept;
 
+  // If this entry matches any addresses, set [*base, *last] to their range.
+  bool match_range(reg_t* base, reg_t* last) const noexcept;
+
   // Is the specified access allowed given the pmpcfg privileges?
   bool access_ok(access_type type, reg_t mode) const noexcept;
 
@@ -75,15 +75,15 @@ class insn_t
 {
 public:
   insn_t() = default;
-  insn_t(insn_bits_t bits) : b(bits) {}
+  insn_t(insn_bits_t bits) : b(bits), imm(0), imm_format(IMM_NONE) { predecode(); }
   insn_bits_t bits() { return b; }
   int length() { return insn_length(b); }
   int64_t i_imm() { return xs(20, 12); }
   int64_t shamt() { return x(20, 6); }
-  int64_t s_imm() { return x(7, 5) + (xs(25, 7) << 5); }
-  int64_t sb_imm() { return (x(8, 4) << 1) + (x(25, 6) << 5) + (x(7, 1) << 11) + (imm_sign() << 12); }
+  int64_t s_imm() { return imm_format == IMM_S ? imm : decode_s_imm(); }
+  int64_t sb_imm() { return imm_format == IMM_SB ? imm : decode_sb_imm(); }
   int64_t u_imm() { return xs(12, 20) << 12; }
-  int64_t uj_imm() { return (x(21, 10) << 1) + (x(20, 1) << 11) + (x(12, 8) << 12) + (imm_sign() << 20); }
+  int64_t uj_imm() { return imm_format == IMM_UJ ? imm : decode_uj_imm(); }
   uint64_t rd() { return x(7, 5); }
   uint64_t rs1() { return x(15, 5); }
   uint64_t rs2() { return x(20, 5); }
@@ -104,8 +104,8 @@ public:
   int64_t rvc_sdsp_imm() { return (x(10, 3) << 3) + (x(7, 3) << 6); }
   int64_t rvc_lw_imm() { return (x(6, 1) << 2) + (x(10, 3) << 3) + (x(5, 1) << 6); }
   int64_t rvc_ld_imm() { return (x(10, 3) << 3) + (x(5, 2) << 6); }
-  int64_t rvc_j_imm() { return (x(3, 3) << 1) + (x(11, 1) << 4) + (x(2, 1) << 5) + (x(7, 1) << 6) + (x(6, 1) << 7) + (x(9, 2) << 8) + (x(8, 1) << 10) + (xs(12, 1) << 11); }
-  int64_t rvc_b_imm() { return (x(3, 2) << 1) + (x(10, 2) << 3) + (x(2, 1) << 5) + (x(5, 2) << 6) + (xs(12, 1) << 8); }
+  int64_t rvc_j_imm() { return imm_format == IMM_RVC_J ? imm : decode_rvc_j_imm(); }
+  int64_t rvc_b_imm() { return imm_format == IMM_RVC_B ? imm : decode_rvc_b_imm(); }
   int64_t rvc_simm3() { return x(10, 3); }
   uint64_t rvc_rd() { return rd(); }
   uint64_t rvc_rs1() { return rd(); }
@@ -196,7 +196,57 @@ public:
   }
 
 private:
+  // Immediates that take many shifts and masks to reassemble are decoded
+  // once, when the instruction is fetched into the icache, instead of on
+  // every execution.  imm_format records which accessor imm belongs to.
+  enum imm_format_t : uint8_t {
+    IMM_NONE,
+    IMM_S,
+    IMM_SB,
+    IMM_UJ,
+    IMM_RVC_J,
+    IMM_RVC_B,
+  };
+
   insn_bits_t b;
+  int32_t imm;
+  imm_format_t imm_format;
+
+  void predecode()
+  {
+    if ((b & 0x3) == 0x3) {
+      switch (b & 0x7f) {
+        case 0x23: // STORE
+        case 0x27: // STORE-FP
+          imm = decode_s_imm(), imm_format = IMM_S;
+          break;
+        case 0x63: // BRANCH
+          imm = decode_sb_imm(), imm_format = IMM_SB;
+          break;
+        case 0x6f: // JAL
+          imm = decode_uj_imm(), imm_format = IMM_UJ;
+          break;
+      }
+    } else if ((b & 0x3) == 0x1) {
+      switch (x(13, 3)) {
+        case 1: // C.JAL
+        case 5: // C.J
+          imm = decode_rvc_j_imm(), imm_format = IMM_RVC_J;
+          break;
+        case 6: // C.BEQZ
+        case 7: // C.BNEZ
+          imm = decode_rvc_b_imm(), imm_format = IMM_RVC_B;
+          break;
+      }
+    }
+  }
+
+  int64_t decode_s_imm() { return x(7, 5) + (xs(25, 7) << 5); }
+  int64_t decode_sb_imm() { return (x(8, 4) << 1) + (x(25, 6) << 5) + (x(7, 1) << 11) + (imm_sign() << 12); }
+  int64_t decode_uj_imm() { return (x(21, 10) << 1) + (x(20, 1) << 11) + (x(12, 8) << 12) + (imm_sign() << 20); }
+  int64_t decode_rvc_j_imm() { return (x(3, 3) << 1) + (x(11, 1) << 4) + (x(2, 1) << 5) + (x(7, 1) << 6) + (x(6, 1) << 7) + (x(9, 2) << 8) + (x(8, 1) << 10) + (xs(12, 1) << 11); }
+  int64_t decode_rvc_b_imm() { return (x(3, 2) << 1) + (x(10, 2) << 3) + (x(2, 1) << 5) + (x(5, 2) << 6) + (xs(12, 1) << 8); }
+
   uint64_t x(int lo, int len) { return (b >> lo) & ((insn_bits_t(1) << len) - 1); }
   uint64_t xs(int lo, int len) { return int64_t(b) << (64 - lo - len) >> (64 - len); }
   uint64_t imm_sign() { return xs(31, 1); }
@@ -207,18 +207,24 @@ static inline bool is_aligned(const unsigned val, const unsigned pos)
        STATE.pc = __npc; \
      } while (0)
 
-class wait_for_interrupt_t {};
-
 #define wfi() \
   do { set_pc_and_serialize(npc); \
-       throw wait_for_interrupt_t(); \
+       return PC_WFI; \
      } while (0)
 
 #define serialize() set_pc_and_serialize(npc)
 
+/* Take a synchronous trap without throwing it through the handler */
+#define raise_trap(t) \
+  do { p->set_pending_trap(t, pc); \
+       return PC_TRAP; \
+     } while (0)
+
 /* Sentinel PC values to serialize simulator pipeline */
 #define PC_SERIALIZE_BEFORE 3
 #define PC_SERIALIZE_AFTER 5
+#define PC_TRAP 7
+#define PC_WFI 9
 #define invalid_pc(pc) ((pc) & 1)
 
 /* Convenience wrappers to simplify softfloat code sequences */
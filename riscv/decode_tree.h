@@ -0,0 +1,131 @@
+// See LICENSE for license details.
+
+#ifndef _RISCV_DECODE_TREE_H
+#define _RISCV_DECODE_TREE_H
+
+#include "decode.h"
+#include <vector>
+
+// Finds the first of a prioritized list of (match, mask) patterns that some
+// instruction bits satisfy, with the same result as searching the list in
+// order but in time proportional to the depth of the tree.
+//
+// Each interior node switches on a field of up to MAX_FIELD_BITS bits that
+// every remaining candidate decodes.  Once no such field is left, the node
+// splits on the single bit decoded by the most candidates, and candidates
+// that don't decode it go down both sides.  Leaves hold the few candidates
+// that are left, in priority order.  The tree isn't modified by lookups.
+template<typename T>
+class decode_tree_t
+{
+public:
+  struct pattern_t
+  {
+    insn_bits_t match;
+    insn_bits_t mask;
+    T value;
+  };
+
+  decode_tree_t() { build({}, T()); }
+
+  // patterns are given highest priority first.  fallback is returned for
+  // bits that match none of them; a pattern that matches everything (mask 0)
+  // takes its place and ends the list.
+  void build(const std::vector<pattern_t>& patterns, T fallback)
+  {
+    std::vector<const pattern_t*> candidates;
+    this->fallback = fallback;
+    for (auto& p : patterns) {
+      if (p.mask == 0) {
+        this->fallback = p.value;
+        break;
+      }
+      candidates.push_back(&p);
+    }
+
+    nodes.assign(1, node_t());
+    leaves.clear();
+    build_node(0, candidates, 0);
+  }
+
+  T lookup(insn_bits_t bits) const
+  {
+    const node_t* n = &nodes[0];
+    while (n->width)
+      n = &nodes[n->first + ((bits >> n->shift) & ((insn_bits_t(1) << n->width) - 1))];
+
+    for (auto p = &leaves[n->first], end = p + n->count; p != end; p++)
+      if ((bits & p->mask) == p->match)
+        return p->value;
+
+    return fallback;
+  }
+
+private:
+  static const size_t LEAF_SIZE = 4;
+  static const unsigned MAX_FIELD_BITS = 8;
+
+  struct node_t
+  {
+    uint8_t shift = 0;
+    uint8_t width = 0;   // 0 for leaves
+    uint32_t first = 0;  // index of the first child, or of the first leaf entry
+    uint32_t count = 0;  // number of leaf entries
+  };
+
+  std::vector<node_t> nodes;
+  std::vector<pattern_t> leaves;
+  T fallback;
+
+  void build_node(size_t idx, const std::vector<const pattern_t*>& candidates, insn_bits_t used)
+  {
+    unsigned shift = 0, width = 0;
+
+    if (candidates.size() > LEAF_SIZE) {
+      insn_bits_t common = ~used;
+      for (auto p : candidates)
+        common &= p->mask;
+
+      if (common) {
+        shift = __builtin_ctzll(common);
+        while (width < MAX_FIELD_BITS && shift + width < 64 && ((common >> (shift + width)) & 1))
+          width++;
+      } else {
+        size_t best = 0;
+        for (unsigned bit = 0; bit < 64; bit++) {
+          size_t n = 0;
+          for (auto p : candidates)
+            n += !((used >> bit) & 1) && ((p->mask >> bit) & 1);
+          if (n > best)
+            best = n, shift = bit;
+        }
+        width = best ? 1 : 0;
+      }
+    }
+
+    if (!width) {
+      nodes[idx].first = leaves.size();
+      nodes[idx].count = candidates.size();
+      for (auto p : candidates)
+        leaves.push_back(*p);
+      return;
+    }
+
+    size_t first = nodes.size();
+    nodes.resize(first + (size_t(1) << width));
+    nodes[idx].shift = shift;
+    nodes[idx].width = width;
+    nodes[idx].first = first;
+
+    insn_bits_t field = ((insn_bits_t(1) << width) - 1) << shift;
+    for (insn_bits_t v = 0; v < (insn_bits_t(1) << width); v++) {
+      std::vector<const pattern_t*> subset;
+      for (auto p : candidates)
+        if (((p->match ^ (v << shift)) & p->mask & field) == 0)
+          subset.push_back(p);
+      build_node(first + v, subset, used | field);
+    }
+  }
+};
+
+#endif
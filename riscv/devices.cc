@@ -1,6 +1,8 @@
 #include "devices.h"
 #include "mmu.h"
+#include <algorithm>
 #include <stdexcept>
+#include <sys/mman.h>
 
 mmio_device_map_t& mmio_device_map()
 {
@@ -16,56 +18,75 @@ void bus_t::add_device(reg_t addr, abstract_device_t* dev)
   // iteration over this sort, which it does. (python's
   // SortedDict is a good analogy)
   devices[addr] = dev;
+
+  ranges.clear();
+  for (auto& [base, device] : devices)
+    ranges.push_back({base, device, dynamic_cast<mem_t*>(device)});
 }
 
-bool bus_t::load(reg_t addr, size_t len, uint8_t* bytes)
+const bus_t::range_t* bus_t::find_range(reg_t addr) const
 {
   // Find the device with the base address closest to but
   // less than addr (price-is-right search)
-  auto it = devices.upper_bound(addr);
-  if (devices.empty() || it == devices.begin()) {
-    // Either the bus is empty, or there weren't 
+  auto it = std::upper_bound(ranges.begin(), ranges.end(), addr,
+                             [](reg_t a, const range_t& r) { return a < r.base; });
+  if (it == ranges.begin()) {
+    // Either the bus is empty, or there weren't
     // any items with a base address <= addr
-    return false;
+    return NULL;
   }
   // Found at least one item with base address <= addr
   // The iterator points to the device after this, so
   // go back by one item.
-  it--;
-  return it->second->load(addr - it->first, len, bytes);
+  return &*(it - 1);
+}
+
+bool bus_t::load(reg_t addr, size_t len, uint8_t* bytes)
+{
+  auto r = find_range(addr);
+  return r && r->dev->load(addr - r->base, len, bytes);
 }
 
 bool bus_t::store(reg_t addr, size_t len, const uint8_t* bytes)
 {
-  // See comments in bus_t::load
-  auto it = devices.upper_bound(addr);
-  if (devices.empty() || it == devices.begin()) {
-    return false;
-  }
-  it--;
-  return it->second->store(addr - it->first, len, bytes);
+  auto r = find_range(addr);
+  return r && r->dev->store(addr - r->base, len, bytes);
 }
 
 std::pair<reg_t, abstract_device_t*> bus_t::find_device(reg_t addr)
 {
-  // See comments in bus_t::load
-  auto it = devices.upper_bound(addr);
-  if (devices.empty() || it == devices.begin()) {
+  auto r = find_range(addr);
+  if (!r)
     return std::make_pair((reg_t)0, (abstract_device_t*)NULL);
-  }
-  it--;
-  return std::make_pair(it->first, it->second);
+  return std::make_pair(r->base, r->dev);
+}
+
+std::pair<reg_t, mem_t*> bus_t::find_mem(reg_t addr)
+{
+  auto r = find_range(addr);
+  if (!r)
+    return std::make_pair((reg_t)0, (mem_t*)NULL);
+  return std::make_pair(r->base, r->mem);
 }
 
 mem_t::mem_t(reg_t size)
-  : sz(size)
+  : flat(NULL), sz(size)
 {
   if (size == 0 || size % PGSIZE != 0)
     throw std::runtime_error("memory size must be a positive multiple of 4 KiB");
+
+  if (size == size_t(size)) {
+    void* p = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (p != MAP_FAILED)
+      flat = (char*)p;
+  }
 }
 
 mem_t::~mem_t()
 {
+  if (flat)
+    munmap(flat, sz);
   for (auto& entry : sparse_memory_map)
     free(entry.second);
 }
@@ -75,6 +96,14 @@ bool mem_t::load_store(reg_t addr, size_t len, uint8_t* bytes, bool store)
   if (addr + len < addr || addr + len > sz)
     return false;
 
+  if (flat) {
+    if (store)
+      memcpy(flat + addr, bytes, len);
+    else
+      memcpy(bytes, flat + addr, len);
+    return true;
+  }
+
   while (len > 0) {
     auto n = std::min(PGSIZE - (addr % PGSIZE), reg_t(len));
 
@@ -92,7 +121,11 @@ bool mem_t::load_store(reg_t addr, size_t len, uint8_t* bytes, bool store)
 }
 
 char* mem_t::contents(reg_t addr) {
+  if (flat)
+    return flat + addr;
+
   reg_t ppn = addr >> PGSHIFT, pgoff = addr % PGSIZE;
+  std::lock_guard<std::mutex> lock(sparse_memory_lock);
   auto search = sparse_memory_map.find(ppn);
   if (search == sparse_memory_map.end()) {
     auto res = (char*)calloc(PGSIZE, 1);
@@ -105,6 +138,11 @@ char* mem_t::contents(reg_t addr) {
 }
 
 void mem_t::dump(std::ostream& o) {
+  if (flat) {
+    o.write(flat, sz);
+    return;
+  }
+
   const char empty[PGSIZE] = {0};
   for (reg_t i = 0; i < sz; i += PGSIZE) {
     reg_t ppn = i >> PGSHIFT;
@@ -6,6 +6,7 @@
 #include "abstract_interrupt_controller.h"
 #include "platform.h"
 #include <map>
+#include <mutex>
 #include <queue>
 #include <vector>
 #include <utility>
@@ -14,6 +15,8 @@
 class processor_t;
 class simif_t;
 
+class mem_t;
+
 class bus_t : public abstract_device_t {
  public:
   bool load(reg_t addr, size_t len, uint8_t* bytes) override;
@@ -21,9 +24,22 @@ class bus_t : public abstract_device_t {
   void add_device(reg_t addr, abstract_device_t* dev);
 
   std::pair<reg_t, abstract_device_t*> find_device(reg_t addr);
+  // Like find_device, but yields NULL unless the device is a mem_t.
+  std::pair<reg_t, mem_t*> find_mem(reg_t addr);
 
  private:
+  struct range_t {
+    reg_t base;
+    abstract_device_t* dev;
+    mem_t* mem; // dev, if it is a mem_t
+  };
+
+  const range_t* find_range(reg_t addr) const;
+
   std::map<reg_t, abstract_device_t*> devices;
+  // The same devices, flattened for lookups, which vastly outnumber
+  // additions.
+  std::vector<range_t> ranges;
 };
 
 class rom_device_t : public abstract_device_t {
@@ -51,7 +67,12 @@ class mem_t : public abstract_device_t {
  private:
   bool load_store(reg_t addr, size_t len, uint8_t* bytes, bool store);
 
+  // All of memory, reserved up front and zero-filled by the host on demand.
+  // NULL if the host couldn't reserve it, in which case pages are allocated
+  // one at a time in sparse_memory_map instead.
+  char* flat;
   std::map<reg_t, char*> sparse_memory_map;
+  std::mutex sparse_memory_lock; // harts may allocate pages concurrently
   reg_t sz;
 };
 
@@ -62,6 +83,7 @@ class clint_t : public abstract_device_t {
   bool store(reg_t addr, size_t len, const uint8_t* bytes) override;
   size_t size() { return CLINT_SIZE; }
   void tick(reg_t rtc_ticks) override;
+  reg_t ticks_until_event() override;
   uint64_t get_mtimecmp(reg_t hartid) { return mtimecmp[hartid]; }
   uint64_t get_mtime() { return mtime; }
  private:
@@ -131,6 +153,7 @@ class ns16550_t : public abstract_device_t {
   bool load(reg_t addr, size_t len, uint8_t* bytes) override;
   bool store(reg_t addr, size_t len, const uint8_t* bytes) override;
   void tick(reg_t rtc_ticks) override;
+  reg_t ticks_until_event() override;
   size_t size() { return NS16550_SIZE; }
  private:
   abstract_interrupt_controller_t *intctrl;
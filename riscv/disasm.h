@@ -5,6 +5,7 @@
 
 #include "common.h"
 #include "decode.h"
+#include "decode_tree.h"
 #include "isa_parser.h"
 #include <string>
 #include <sstream>
@@ -94,9 +95,11 @@ class disassembler_t
   static const int HASH_SIZE = 255;
   std::vector<const disasm_insn_t*> chain[HASH_SIZE+1];
 
-  void add_instructions(const isa_parser_t* isa);
+  // Built from the chains on the first lookup after they change.
+  mutable decode_tree_t<const disasm_insn_t*> tree;
+  mutable bool tree_stale = true;
 
-  const disasm_insn_t* probe_once(insn_t insn, size_t idx) const;
+  void add_instructions(const isa_parser_t* isa);
 
   static const unsigned int MASK1 = 0x7f;
   static const unsigned int MASK2 = 0xe003;
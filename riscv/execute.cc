@@ -3,6 +3,7 @@
 #include "config.h"
 #include "processor.h"
 #include "mmu.h"
+#include "jit.h"
 #include "disasm.h"
 #include "decode_macros.h"
 #include <cassert>
@@ -173,16 +174,11 @@ static inline reg_t execute_insn_logged(processor_t* p, reg_t pc, insn_fetch_t f
 
   try {
     npc = fetch.func(p, fetch.insn, pc);
-    if (npc != PC_SERIALIZE_BEFORE) {
+    if (npc != PC_SERIALIZE_BEFORE && npc != PC_TRAP) {
       if (p->get_log_commits_enabled()) {
         commit_log_print_insn(p, pc, fetch.insn);
       }
      }
-  } catch (wait_for_interrupt_t &t) {
-      if (p->get_log_commits_enabled()) {
-        commit_log_print_insn(p, pc, fetch.insn);
-      }
-      throw;
   } catch(mem_trap_t& t) {
       //handle segfault in midlle of vector load/store
       if (p->get_log_commits_enabled()) {
@@ -197,7 +193,6 @@ static inline reg_t execute_insn_logged(processor_t* p, reg_t pc, insn_fetch_t f
   } catch(...) {
     throw;
   }
-  p->update_histogram(pc);
 
   return npc;
 }
@@ -205,7 +200,21 @@ static inline reg_t execute_insn_logged(processor_t* p, reg_t pc, insn_fetch_t f
 bool processor_t::slow_path()
 {
   return debug || state.single_step != state.STEP_NONE || state.debug_mode ||
-         log_commits_enabled || histogram_enabled || in_wfi || check_triggers_icount;
+         in_wfi || check_triggers_icount;
+}
+
+void processor_t::deliver_trap(trap_t& t, reg_t epc)
+{
+  take_trap(t, epc);
+
+  // Trigger action takes priority over single step
+  auto match = TM.detect_trap_match(t);
+  if (match.has_value())
+    take_trigger_action(match->action, 0, state.pc, 0);
+  else if (unlikely(state.single_step == state.STEP_STEPPED)) {
+    state.single_step = state.STEP_NONE;
+    enter_debug_mode(DCSR_CAUSE_STEP);
+  }
 }
 
 // fetch/decode/execute loop
@@ -222,16 +231,58 @@ void processor_t::step(size_t n)
     }
   }
 
+  (this->*step_loop_func)(n);
+
+  if (unlikely(mmu->is_tracing()))
+    mmu->flush_trace();
+}
+
+void processor_t::select_step_loop()
+{
+  if (log_commits_enabled || histogram_enabled || mmu->is_tracing())
+    step_loop_func = &processor_t::step_loop<true, false>;
+  else if (jit)
+    step_loop_func = &processor_t::step_loop<false, true>;
+  else
+    step_loop_func = &processor_t::step_loop<false, false>;
+
+  insn_variant = insn_desc_t::variant(xlen, extension_enabled('E'), log_commits_enabled);
+}
+
+// The body of step(), specialized so that the fast path doesn't retest modes
+// that can only change between calls.
+template<bool logged, bool use_jit>
+void processor_t::step_loop(size_t n)
+{
   while (n > 0) {
     size_t instret = 0;
     reg_t pc = state.pc;
     mmu_t* _mmu = mmu;
 
+    // Return to the outer simulation loop, which gives other devices/harts a
+    // chance to generate interrupts.
+    //
+    // In the debug ROM this prevents us from wasting time looping, but also
+    // allows us to switch to other threads only once per idle loop in case
+    // there is activity.
+    #define wait_for_interrupt() \
+      do { \
+        n = ++instret; \
+        in_wfi = true; \
+      } while (0)
+
     #define advance_pc() \
       if (unlikely(invalid_pc(pc))) { \
         switch (pc) { \
           case PC_SERIALIZE_BEFORE: state.serialized = true; break; \
           case PC_SERIALIZE_AFTER: ++instret; break; \
+          case PC_TRAP: \
+            deliver_trap(*pending_trap, pending_trap_pc); \
+            pending_trap->~trap_t(); \
+            pending_trap = NULL; \
+            n = instret; \
+            break; \
+          case PC_WFI: wait_for_interrupt(); break; \
           default: abort(); \
         } \
         pc = state.pc; \
@@ -273,30 +324,83 @@ void processor_t::step(size_t n)
 
           // debug mode wfis must nop
           if (unlikely(in_wfi && !state.debug_mode)) {
-            throw wait_for_interrupt_t();
+            wait_for_interrupt();
+            break;
           }
 
           in_wfi = false;
           insn_fetch_t fetch = mmu->load_insn(pc);
           if (debug && !state.serialized)
             disasm(fetch.insn);
+          reg_t insn_pc = pc;
           pc = execute_insn_logged(this, pc, fetch);
+          update_histogram(insn_pc);
           advance_pc();
         }
       }
-      else while (instret < n)
+      else if (logged) while (instret < n)
       {
-        // Main simulation loop, fast path.
-        for (auto ic_entry = _mmu->access_icache(pc); ; ) {
-          auto fetch = ic_entry->data;
-          pc = execute_insn_fast(this, pc, fetch);
-          ic_entry = ic_entry->next;
-          if (unlikely(ic_entry->tag != pc))
+        // Main simulation loop, fast path with commit logging, the PC
+        // histogram or memory tracing.  Histogram counts accumulate in the
+        // icache blocks and are credited to their PCs when the blocks are
+        // refilled.
+        auto block = _mmu->access_icache(pc);
+        for (size_t idx = 0; ; ) {
+          auto ic_entry = &block->entries[idx];
+          if (unlikely(_mmu->is_tracing()))
+            _mmu->trace_fetch(pc, ic_entry->data.insn.length());
+          pc = execute_insn_logged(this, pc, ic_entry->data);
+          if (histogram_enabled)
+            block->hits[idx]++;
+          if (unlikely(pc != ic_entry->npc || !_mmu->icache_block_valid(block)))
             break;
           if (unlikely(instret + 1 == n))
             break;
           instret++;
           state.pc = pc;
+          if (unlikely(++idx == block->size))
+            block = _mmu->icache_fall_through(block, pc, &idx);
+        }
+
+        advance_pc();
+      }
+      else while (instret < n)
+      {
+        // Main simulation loop, fast path.
+        auto block = _mmu->access_icache(pc);
+        if (use_jit && likely(n - instret > icache_block_t::MAX_INSNS)) {
+          if (unlikely(!block->jit) && ++block->heat == jit_t::HOT_THRESHOLD)
+            block->jit = jit->translate(block);
+          if (block->jit) {
+            jit_exit_t exit = block->jit();
+            if (likely(exit.insns != 0)) {
+              instret += exit.insns;
+              pc = state.pc = exit.pc;
+              continue;
+            }
+          }
+        }
+
+        for (size_t idx = 0; ; ) {
+          auto ic_entry = &block->entries[idx];
+          pc = execute_insn_fast(this, pc, ic_entry->data);
+          if (unlikely(!_mmu->icache_block_valid(block) || instret + 1 == n))
+            break;
+          if (unlikely(pc != ic_entry->npc)) {
+            // Chain straight to the target of a taken branch or jump, unless
+            // the outer loop should consider it for translation.
+            if (use_jit || invalid_pc(pc))
+              break;
+            instret++;
+            state.pc = pc;
+            block = _mmu->icache_taken_branch(block, pc);
+            idx = 0;
+            continue;
+          }
+          instret++;
+          state.pc = pc;
+          if (unlikely(++idx == block->size))
+            block = _mmu->icache_fall_through(block, pc, &idx);
         }
 
         advance_pc();
@@ -304,17 +408,8 @@ void processor_t::step(size_t n)
     }
     catch(trap_t& t)
     {
-      take_trap(t, pc);
+      deliver_trap(t, pc);
       n = instret;
-
-      // Trigger action takes priority over single step
-      auto match = TM.detect_trap_match(t);
-      if (match.has_value())
-        take_trigger_action(match->action, 0, state.pc, 0);
-      else if (unlikely(state.single_step == state.STEP_STEPPED)) {
-        state.single_step = state.STEP_NONE;
-        enter_debug_mode(DCSR_CAUSE_STEP);
-      }
     }
     catch (triggers::matched_t& t)
     {
@@ -328,17 +423,6 @@ void processor_t::step(size_t n)
     {
       enter_debug_mode(DCSR_CAUSE_SWBP);
     }
-    catch (wait_for_interrupt_t &t)
-    {
-      // Return to the outer simulation loop, which gives other devices/harts a
-      // chance to generate interrupts.
-      //
-      // In the debug ROM this prevents us from wasting time looping, but also
-      // allows us to switch to other threads only once per idle loop in case
-      // there is activity.
-      n = ++instret;
-      in_wfi = true;
-    }
 
     state.minstret->bump(instret);
 
@@ -0,0 +1,506 @@
+// See LICENSE for license details.
+
+#include "jit.h"
+#include "processor.h"
+#include "mmu.h"
+#include <sys/mman.h>
+#include <cstring>
+#include <cstddef>
+
+#if defined(__x86_64__)
+
+namespace {
+
+enum host_reg_t { RAX = 0, RCX = 1, RDX = 2, RBX = 3, RSI = 6, RDI = 7 };
+
+// x86 condition codes, as encoded in jcc and setcc.  Flipping the low bit
+// negates the condition.
+enum cond_t { CC_B = 0x2, CC_AE = 0x3, CC_E = 0x4, CC_NE = 0x5, CC_L = 0xc, CC_GE = 0xd };
+
+enum uop_kind_t { UOP_LI, UOP_ALU, UOP_ALUW, UOP_LOAD, UOP_STORE, UOP_BRANCH, UOP_JAL, UOP_JALR };
+
+enum alu_op_t {
+  ALU_ADD, ALU_SUB, ALU_AND, ALU_OR, ALU_XOR, ALU_SLL, ALU_SRL, ALU_SRA,
+  ALU_SLT, ALU_SLTU, ALU_MUL, ALU_MULH, ALU_MULHU
+};
+
+// An instruction reduced to one of the few shapes the translator emits.
+struct uop_t {
+  uop_kind_t kind;
+  alu_op_t op;
+  cond_t cond;
+  unsigned rd, rs1, rs2;
+  bool use_imm;   // ALU: second operand is imm rather than rs2
+  int64_t imm;    // immediate, address offset or jump target
+  unsigned size;  // memory access size in bytes
+  bool is_signed; // loads only
+};
+
+bool li(uop_t* u, unsigned rd, int64_t imm)
+{
+  *u = {UOP_LI, ALU_ADD, CC_E, rd, 0, 0, true, imm, 0, false};
+  return true;
+}
+
+bool alu(uop_t* u, uop_kind_t kind, alu_op_t op, unsigned rd, unsigned rs1, unsigned rs2)
+{
+  *u = {kind, op, CC_E, rd, rs1, rs2, false, 0, 0, false};
+  return true;
+}
+
+bool alu_imm(uop_t* u, uop_kind_t kind, alu_op_t op, unsigned rd, unsigned rs1, int64_t imm)
+{
+  *u = {kind, op, CC_E, rd, rs1, 0, true, imm, 0, false};
+  return true;
+}
+
+bool load(uop_t* u, unsigned size, bool is_signed, unsigned rd, unsigned rs1, int64_t imm)
+{
+  *u = {UOP_LOAD, ALU_ADD, CC_E, rd, rs1, 0, true, imm, size, is_signed};
+  return true;
+}
+
+bool store(uop_t* u, unsigned size, unsigned rs2, unsigned rs1, int64_t imm)
+{
+  *u = {UOP_STORE, ALU_ADD, CC_E, 0, rs1, rs2, true, imm, size, false};
+  return true;
+}
+
+bool branch(uop_t* u, cond_t cond, unsigned rs1, unsigned rs2, reg_t target)
+{
+  *u = {UOP_BRANCH, ALU_ADD, cond, 0, rs1, rs2, false, (int64_t)target, 0, false};
+  return true;
+}
+
+bool jal(uop_t* u, unsigned rd, reg_t target)
+{
+  *u = {UOP_JAL, ALU_ADD, CC_E, rd, 0, 0, true, (int64_t)target, 0, false};
+  return true;
+}
+
+bool jalr(uop_t* u, unsigned rd, unsigned rs1, int64_t imm)
+{
+  *u = {UOP_JALR, ALU_ADD, CC_E, rd, rs1, 0, true, imm, 0, false};
+  return true;
+}
+
+bool decode_rv64(processor_t* p, insn_t insn, reg_t pc, uop_t* u)
+{
+  const uint64_t b = insn.bits();
+  const unsigned funct3 = (b >> 12) & 7;
+  const unsigned funct7 = (b >> 25) & 0x7f;
+  const unsigned rd = insn.rd(), rs1 = insn.rs1(), rs2 = insn.rs2();
+  const bool has_mul = p->extension_enabled('M') || p->extension_enabled(EXT_ZMMUL);
+
+  static const alu_op_t op_imm[] = {ALU_ADD, ALU_SLL, ALU_SLT, ALU_SLTU, ALU_XOR, ALU_SRL, ALU_OR, ALU_AND};
+  static const cond_t branch_cond[] = {CC_E, CC_NE, CC_E, CC_E, CC_L, CC_GE, CC_B, CC_AE};
+
+  switch (b & 0x7f) {
+    case 0x37: return li(u, rd, insn.u_imm());
+    case 0x17: return li(u, rd, pc + insn.u_imm());
+    case 0x6f: return jal(u, rd, pc + insn.uj_imm());
+    case 0x67: return funct3 == 0 && jalr(u, rd, rs1, insn.i_imm());
+    case 0x63:
+      return funct3 != 2 && funct3 != 3 &&
+             branch(u, branch_cond[funct3], rs1, rs2, pc + insn.sb_imm());
+    case 0x03:
+      return funct3 != 7 && load(u, 1 << (funct3 & 3), funct3 < 4, rd, rs1, insn.i_imm());
+    case 0x23:
+      return funct3 < 4 && store(u, 1 << funct3, rs2, rs1, insn.s_imm());
+    case 0x13:
+      if (funct3 == 1 && (b >> 26) != 0)
+        return false;
+      if (funct3 == 5) {
+        if ((b >> 26) == 0x10)
+          return alu_imm(u, UOP_ALU, ALU_SRA, rd, rs1, insn.shamt());
+        if ((b >> 26) != 0)
+          return false;
+      }
+      if (funct3 == 1 || funct3 == 5)
+        return alu_imm(u, UOP_ALU, op_imm[funct3], rd, rs1, insn.shamt());
+      return alu_imm(u, UOP_ALU, op_imm[funct3], rd, rs1, insn.i_imm());
+    case 0x1b:
+      if (funct3 == 0)
+        return alu_imm(u, UOP_ALUW, ALU_ADD, rd, rs1, insn.i_imm());
+      if (funct3 == 1 && funct7 == 0)
+        return alu_imm(u, UOP_ALUW, ALU_SLL, rd, rs1, rs2);
+      if (funct3 == 5 && (funct7 == 0 || funct7 == 0x20))
+        return alu_imm(u, UOP_ALUW, funct7 ? ALU_SRA : ALU_SRL, rd, rs1, rs2);
+      return false;
+    case 0x33:
+      if (funct7 == 0)
+        return alu(u, UOP_ALU, op_imm[funct3], rd, rs1, rs2);
+      if (funct7 == 0x20 && (funct3 == 0 || funct3 == 5))
+        return alu(u, UOP_ALU, funct3 ? ALU_SRA : ALU_SUB, rd, rs1, rs2);
+      if (funct7 == 1 && has_mul && (funct3 == 0 || funct3 == 1 || funct3 == 3))
+        return alu(u, UOP_ALU, funct3 == 0 ? ALU_MUL : funct3 == 1 ? ALU_MULH : ALU_MULHU, rd, rs1, rs2);
+      return false;
+    case 0x3b:
+      if (funct7 == 0 && (funct3 == 0 || funct3 == 1 || funct3 == 5))
+        return alu(u, UOP_ALUW, op_imm[funct3], rd, rs1, rs2);
+      if (funct7 == 0x20 && (funct3 == 0 || funct3 == 5))
+        return alu(u, UOP_ALUW, funct3 ? ALU_SRA : ALU_SUB, rd, rs1, rs2);
+      if (funct7 == 1 && funct3 == 0 && has_mul)
+        return alu(u, UOP_ALUW, ALU_MUL, rd, rs1, rs2);
+      return false;
+  }
+  return false;
+}
+
+// Reserved and hint encodings that the handlers reject with require() are
+// left to the interpreter.
+bool decode_rvc(insn_t insn, reg_t pc, uop_t* u)
+{
+  const uint64_t b = insn.bits();
+  const unsigned funct3 = (b >> 13) & 7;
+  const unsigned rd = insn.rvc_rd(), rs2 = insn.rvc_rs2();
+  const unsigned rs1s = insn.rvc_rs1s(), rs2s = insn.rvc_rs2s();
+
+  switch ((b & 3) << 3 | funct3) {
+    case 000:
+      return insn.rvc_addi4spn_imm() != 0 &&
+             alu_imm(u, UOP_ALU, ALU_ADD, rs2s, X_SP, insn.rvc_addi4spn_imm());
+    case 002: return load(u, 4, true, rs2s, rs1s, insn.rvc_lw_imm());
+    case 003: return load(u, 8, true, rs2s, rs1s, insn.rvc_ld_imm());
+    case 006: return store(u, 4, rs2s, rs1s, insn.rvc_lw_imm());
+    case 007: return store(u, 8, rs2s, rs1s, insn.rvc_ld_imm());
+    case 010: return alu_imm(u, UOP_ALU, ALU_ADD, rd, rd, insn.rvc_imm());
+    case 011: return rd != 0 && alu_imm(u, UOP_ALUW, ALU_ADD, rd, rd, insn.rvc_imm());
+    case 012: return li(u, rd, insn.rvc_imm());
+    case 013:
+      if (rd == X_SP)
+        return insn.rvc_addi16sp_imm() != 0 &&
+               alu_imm(u, UOP_ALU, ALU_ADD, X_SP, X_SP, insn.rvc_addi16sp_imm());
+      return insn.rvc_imm() != 0 && li(u, rd, insn.rvc_imm() << 12);
+    case 014:
+      switch ((b >> 10) & 3) {
+        case 0: return alu_imm(u, UOP_ALU, ALU_SRL, rs1s, rs1s, insn.rvc_zimm());
+        case 1: return alu_imm(u, UOP_ALU, ALU_SRA, rs1s, rs1s, insn.rvc_zimm());
+        case 2: return alu_imm(u, UOP_ALU, ALU_AND, rs1s, rs1s, insn.rvc_imm());
+      }
+      if (b & (1 << 12)) {
+        switch ((b >> 5) & 3) {
+          case 0: return alu(u, UOP_ALUW, ALU_SUB, rs1s, rs1s, rs2s);
+          case 1: return alu(u, UOP_ALUW, ALU_ADD, rs1s, rs1s, rs2s);
+        }
+        return false;
+      } else {
+        static const alu_op_t ops[] = {ALU_SUB, ALU_XOR, ALU_OR, ALU_AND};
+        return alu(u, UOP_ALU, ops[(b >> 5) & 3], rs1s, rs1s, rs2s);
+      }
+    case 015: return jal(u, 0, pc + insn.rvc_j_imm());
+    case 016: return branch(u, CC_E, rs1s, 0, pc + insn.rvc_b_imm());
+    case 017: return branch(u, CC_NE, rs1s, 0, pc + insn.rvc_b_imm());
+    case 020: return alu_imm(u, UOP_ALU, ALU_SLL, rd, rd, insn.rvc_zimm());
+    case 022: return rd != 0 && load(u, 4, true, rd, X_SP, insn.rvc_lwsp_imm());
+    case 023: return rd != 0 && load(u, 8, true, rd, X_SP, insn.rvc_ldsp_imm());
+    case 024:
+      if (!(b & (1 << 12))) {
+        if (rs2 == 0)
+          return rd != 0 && jalr(u, 0, rd, 0);
+        return alu(u, UOP_ALU, ALU_ADD, rd, 0, rs2);
+      }
+      if (rs2 == 0)
+        return rd != 0 && jalr(u, X_RA, rd, 0);
+      return alu(u, UOP_ALU, ALU_ADD, rd, rd, rs2);
+    case 026: return store(u, 4, rs2, X_SP, insn.rvc_swsp_imm());
+    case 027: return store(u, 8, rs2, X_SP, insn.rvc_sdsp_imm());
+  }
+  return false;
+}
+
+class emitter_t
+{
+public:
+  emitter_t(std::vector<uint8_t>& buf) : buf(buf) {}
+
+  template<typename... Bytes>
+  void op(Bytes... bytes) { for (int b : {int(bytes)...}) buf.push_back(b); }
+
+  void imm32(int32_t x) { for (int i = 0; i < 4; i++) buf.push_back(x >> (8 * i)); }
+  void imm64(uint64_t x) { for (int i = 0; i < 8; i++) buf.push_back(x >> (8 * i)); }
+
+  // Guest registers live at rbx + 8 * index; x0 is always zero in memory.
+  void load_reg(host_reg_t h, unsigned r)
+  {
+    if (r == 0) {
+      op(0x31, 0xc0 | h << 3 | h);          // xor h32, h32
+    } else {
+      op(0x48, 0x8b, 0x80 | h << 3 | RBX);  // mov h, [rbx + disp32]
+      imm32(8 * r);
+    }
+  }
+
+  void store_reg(host_reg_t h, unsigned r)
+  {
+    if (r != 0) {
+      op(0x48, 0x89, 0x80 | h << 3 | RBX);  // mov [rbx + disp32], h
+      imm32(8 * r);
+    }
+  }
+
+  void mov_imm(host_reg_t h, int64_t x)
+  {
+    if (x == (int32_t)x) {
+      op(0x48, 0xc7, 0xc0 | h);             // mov h, simm32
+      imm32(x);
+    } else {
+      op(0x48, 0xb8 | h);                   // movabs h, imm64
+      imm64(x);
+    }
+  }
+
+  void prologue(reg_t* xpr)
+  {
+    op(0x53);                               // push rbx
+    op(0x48, 0xbb);                         // movabs rbx, xpr
+    imm64((uintptr_t)xpr);
+  }
+
+  // Return {pc, insns} in rax:rdx.
+  static const size_t EXIT_BYTES = 17;
+  void exit(reg_t pc, size_t insns)
+  {
+    op(0x48, 0xb8);                         // movabs rax, pc
+    imm64(pc);
+    op(0xba);                               // mov edx, insns
+    imm32(insns);
+    op(0x5b, 0xc3);                         // pop rbx; ret
+  }
+
+  void exit_if(cond_t cond, reg_t pc, size_t insns)
+  {
+    op(0x70 | (cond ^ 1), EXIT_BYTES);      // j!cond over the exit
+    exit(pc, insns);
+  }
+
+  // rax = rax op rcx, sign-extending 32-bit results for the W forms.
+  void alu(alu_op_t alu_op, bool w)
+  {
+    if (!w)
+      op(0x48);
+    switch (alu_op) {
+      case ALU_ADD: op(0x01, 0xc8); break;
+      case ALU_SUB: op(0x29, 0xc8); break;
+      case ALU_AND: op(0x21, 0xc8); break;
+      case ALU_OR:  op(0x09, 0xc8); break;
+      case ALU_XOR: op(0x31, 0xc8); break;
+      // x86 masks shift counts to the operand width, as RISC-V does.
+      case ALU_SLL: op(0xd3, 0xe0); break;
+      case ALU_SRL: op(0xd3, 0xe8); break;
+      case ALU_SRA: op(0xd3, 0xf8); break;
+      case ALU_SLT:  op(0x39, 0xc8, 0x0f, 0x9c, 0xc0, 0x0f, 0xb6, 0xc0); break;
+      case ALU_SLTU: op(0x39, 0xc8, 0x0f, 0x92, 0xc0, 0x0f, 0xb6, 0xc0); break;
+      case ALU_MUL:   op(0x0f, 0xaf, 0xc1); break;
+      case ALU_MULH:  op(0xf7, 0xe9, 0x48, 0x89, 0xd0); break;
+      case ALU_MULHU: op(0xf7, 0xe1, 0x48, 0x89, 0xd0); break;
+    }
+    if (w)
+      op(0x48, 0x63, 0xc0);                 // movsxd rax, eax
+  }
+
+  // Leave the guest address in rax and the host address of its page in rsi,
+  // or exit at pc if the access isn't aligned or misses in the TLB.
+  void translate_addr(const uop_t& u, const reg_t* tlb_tag, const tlb_entry_t* tlb_data,
+                      reg_t pc, size_t insns)
+  {
+    load_reg(RAX, u.rs1);
+    if (u.imm) {
+      op(0x48, 0x05);                       // add rax, simm32
+      imm32(u.imm);
+    }
+    if (u.size > 1) {
+      op(0xa8, u.size - 1);                 // test al, size - 1
+      exit_if(CC_NE, pc, insns);
+    }
+    op(0x48, 0x89, 0xc2);                   // mov rdx, rax
+    op(0x48, 0xc1, 0xea, PGSHIFT);          // shr rdx, PGSHIFT
+    op(0x0f, 0xb6, 0xca);                   // movzx ecx, dl
+    op(0x48, 0xbe);                         // movabs rsi, tlb_tag
+    imm64((uintptr_t)tlb_tag);
+    op(0x48, 0x3b, 0x14, 0xce);             // cmp rdx, [rsi + rcx * 8]
+    exit_if(CC_NE, pc, insns);
+    op(0x48, 0xbe);                         // movabs rsi, tlb_data
+    imm64((uintptr_t)tlb_data);
+    op(0xc1, 0xe1, 0x04);                   // shl ecx, 4
+    op(0x48, 0x8b, 0x34, 0x0e);             // mov rsi, [rsi + rcx]
+  }
+
+  void load(const uop_t& u)
+  {
+    switch (u.size) {                       // rax = [rsi + rax]
+      case 1: u.is_signed ? op(0x48, 0x0f, 0xbe) : op(0x0f, 0xb6); break;
+      case 2: u.is_signed ? op(0x48, 0x0f, 0xbf) : op(0x0f, 0xb7); break;
+      case 4: u.is_signed ? op(0x48, 0x63) : op(0x8b); break;
+      case 8: op(0x48, 0x8b); break;
+    }
+    op(0x04, 0x06);
+  }
+
+  void store(const uop_t& u)
+  {
+    switch (u.size) {                       // [rsi + rax] = rdi
+      case 1: op(0x40, 0x88); break;
+      case 2: op(0x66, 0x89); break;
+      case 4: op(0x89); break;
+      case 8: op(0x48, 0x89); break;
+    }
+    op(0x3c, 0x06);
+  }
+
+private:
+  std::vector<uint8_t>& buf;
+};
+
+}
+
+static_assert(sizeof(tlb_entry_t) == 16 && offsetof(tlb_entry_t, host_offset) == 0,
+              "the JIT indexes tlb_data with a shift");
+#endif
+
+static const size_t CODE_SIZE = 32 << 20;
+
+jit_t::jit_t(processor_t* proc)
+  : proc(proc), code_base(NULL), code_size(0), code_used(0)
+{
+#if defined(__x86_64__)
+  void* p = mmap(NULL, CODE_SIZE, PROT_READ | PROT_WRITE | PROT_EXEC,
+                 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (p == MAP_FAILED) {
+    fprintf(stderr, "warning: unable to map JIT code buffer; interpreting only\n");
+  } else {
+    code_base = (uint8_t*)p;
+    code_size = CODE_SIZE;
+  }
+#endif
+}
+
+jit_t::~jit_t()
+{
+  if (code_base)
+    munmap(code_base, code_size);
+}
+
+bool jit_t::host_supported()
+{
+#if defined(__x86_64__)
+  return true;
+#else
+  return false;
+#endif
+}
+
+jit_func_t jit_t::translate(icache_block_t* block)
+{
+#if defined(__x86_64__)
+  mmu_t* mmu = proc->get_mmu();
+  if (!code_base || proc->get_xlen() != 64 ||
+      mmu->is_target_big_endian() || proc->extension_enabled('E'))
+    return NULL;
+
+  static_assert(mmu_t::TLB_ENTRIES == 256, "the JIT indexes the TLB with a byte");
+  const bool rvc = proc->extension_enabled(EXT_ZCA);
+  const reg_t* xpr = &proc->get_state()->XPR[0];
+
+  buf.clear();
+  emitter_t e(buf);
+  e.prologue(const_cast<reg_t*>(xpr));
+
+  reg_t pc = block->tag;
+  size_t i = 0;
+  bool ended = false;
+  for (; i < block->size && !ended; i++) {
+    insn_t insn = block->entries[i].data.insn;
+    reg_t npc = block->entries[i].npc;
+    uop_t u;
+    bool ok = insn.length() == 4 ? decode_rv64(proc, insn, pc, &u) :
+              insn.length() == 2 && rvc && decode_rvc(insn, pc, &u);
+    // Without C, a misaligned target traps; let the interpreter raise it.
+    if (!ok || ((u.kind == UOP_BRANCH || u.kind == UOP_JAL) && (u.imm & 2) && !rvc) ||
+        (u.kind == UOP_JALR && !rvc))
+      break;
+
+    switch (u.kind) {
+      case UOP_LI:
+        if (u.rd) {
+          e.mov_imm(RAX, u.imm);
+          e.store_reg(RAX, u.rd);
+        }
+        break;
+      case UOP_ALU:
+      case UOP_ALUW:
+        if (u.rd) {
+          e.load_reg(RAX, u.rs1);
+          if (u.use_imm)
+            e.mov_imm(RCX, u.imm);
+          else
+            e.load_reg(RCX, u.rs2);
+          e.alu(u.op, u.kind == UOP_ALUW);
+          e.store_reg(RAX, u.rd);
+        }
+        break;
+      case UOP_LOAD:
+        e.translate_addr(u, mmu->tlb_load_tag, mmu->tlb_data, pc, i);
+        e.load(u);
+        e.store_reg(RAX, u.rd);
+        break;
+      case UOP_STORE:
+        e.translate_addr(u, mmu->tlb_store_tag, mmu->tlb_data, pc, i);
+        e.load_reg(RDI, u.rs2);
+        e.store(u);
+        break;
+      case UOP_BRANCH:
+        e.load_reg(RAX, u.rs1);
+        e.load_reg(RCX, u.rs2);
+        e.op(0x48, 0x39, 0xc8);             // cmp rax, rcx
+        e.exit_if(u.cond, u.imm, i + 1);
+        break;
+      case UOP_JAL:
+        if (u.rd) {
+          e.mov_imm(RAX, npc);
+          e.store_reg(RAX, u.rd);
+        }
+        e.exit(u.imm, i + 1);
+        ended = true;
+        break;
+      case UOP_JALR:
+        e.load_reg(RAX, u.rs1);
+        if (u.imm) {
+          e.op(0x48, 0x05);                 // add rax, simm32
+          e.imm32(u.imm);
+        }
+        e.op(0x48, 0x83, 0xe0, 0xfe);       // and rax, -2
+        if (u.rd) {
+          e.mov_imm(RCX, npc);
+          e.store_reg(RCX, u.rd);
+        }
+        e.op(0xba);                         // mov edx, insns
+        e.imm32(i + 1);
+        e.op(0x5b, 0xc3);                   // pop rbx; ret
+        ended = true;
+        break;
+    }
+    pc = npc;
+  }
+
+  if (i == 0)
+    return NULL;
+  if (!ended)
+    e.exit(pc, i);
+
+  // When the buffer fills up, start over.  Flushing the icache drops every
+  // block that points into the old translations.
+  if (code_used + buf.size() > code_size) {
+    code_used = 0;
+    mmu->flush_icache();
+    return NULL;
+  }
+
+  uint8_t* code = code_base + code_used;
+  memcpy(code, buf.data(), buf.size());
+  code_used += (buf.size() + 15) & ~size_t(15);
+  return (jit_func_t)code;
+#else
+  return NULL;
+#endif
+}
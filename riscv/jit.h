@@ -0,0 +1,41 @@
+// See LICENSE for license details.
+
+#ifndef _RISCV_JIT_H
+#define _RISCV_JIT_H
+
+#include "decode.h"
+#include "mmu.h"
+#include <vector>
+
+class processor_t;
+
+// Translates hot icache blocks of RV64 integer code into x86-64 machine code.
+//
+// Translated code keeps the guest registers in state_t::XPR and reaches memory
+// only through the MMU's TLB, so it never calls back into the simulator and
+// never throws.  Whatever it can't finish inline (TLB misses, misaligned
+// accesses, MMIO, CSRs, FP, vector, ...) ends the translation early, and the
+// interpreter resumes from that instruction.
+class jit_t
+{
+public:
+  // Blocks are translated once they have been entered this many times.
+  static const uint32_t HOT_THRESHOLD = 64;
+
+  jit_t(processor_t* proc);
+  ~jit_t();
+
+  static bool host_supported();
+
+  // Returns NULL if the block doesn't start with a translatable instruction.
+  jit_func_t translate(icache_block_t* block);
+
+private:
+  processor_t* proc;
+  uint8_t* code_base;
+  size_t code_size;
+  size_t code_used;
+  std::vector<uint8_t> buf;
+};
+
+#endif
@@ -5,6 +5,7 @@
 #include "arith.h"
 #include "simif.h"
 #include "processor.h"
+#include <algorithm>
 
 mmu_t::mmu_t(simif_t* sim, endianness_t endianness, processor_t* proc)
  : sim(sim), proc(proc),
@@ -19,6 +20,30 @@ mmu_t::mmu_t(simif_t* sim, endianness_t endianness, processor_t* proc)
 #ifndef RISCV_ENABLE_DUAL_ENDIAN
   assert(endianness == endianness_little);
 #endif
+  stlb_sets = sim->get_cfg().stlb_sets;
+  stlb_ways = sim->get_cfg().stlb_ways;
+  stlb.resize(stlb_sets * stlb_ways);
+  stlb_victim.resize(stlb_sets);
+  memset(stlb_superpages, 0, sizeof(stlb_superpages));
+  stlb_superpage_victim = 0;
+  stlb_epoch = 1;
+  memset(pwc, 0, sizeof(pwc));
+  pwc_epoch = 1;
+
+  pmp_map_valid = false;
+  tracing = false;
+
+  icache_epoch = 0;
+  for (size_t i = 0; i < ICACHE_BLOCKS; i++) {
+    icache[i].tag = -1;
+    icache[i].epoch = icache_epoch;
+    icache[i].size = 0;
+    icache[i].next = nullptr;
+    icache[i].taken = nullptr;
+    icache[i].jit = nullptr;
+    icache[i].heat = 0;
+    icache[i].hits[0] = 0;
+  }
   flush_tlb();
   yield_load_reservation();
 }
@@ -29,11 +54,23 @@ mmu_t::~mmu_t()
 
 void mmu_t::flush_icache()
 {
-  for (size_t i = 0; i < ICACHE_ENTRIES; i++)
-    icache[i].tag = -1;
+  icache_epoch++;
+}
+
+void mmu_t::collect_icache_histogram()
+{
+  for (size_t i = 0; i < ICACHE_BLOCKS; i++)
+    collect_icache_hits(&icache[i]);
 }
 
 void mmu_t::flush_tlb()
+{
+  stlb_epoch++;
+  pwc_epoch++;
+  flush_tlb_for_privilege_change();
+}
+
+void mmu_t::flush_tlb_for_privilege_change()
 {
   memset(tlb_insn_tag, -1, sizeof(tlb_insn_tag));
   memset(tlb_load_tag, -1, sizeof(tlb_load_tag));
@@ -42,6 +79,52 @@ void mmu_t::flush_tlb()
   flush_icache();
 }
 
+// Besides the CSRs whose writes flush the TLB, these are all that can change
+// the outcome of a page table walk.
+static uint32_t stlb_context(const mem_access_info_t& access_info)
+{
+  return access_info.type | (access_info.effective_priv << 2) |
+         (access_info.effective_virt << 4) | (access_info.flags.hlvx << 5);
+}
+
+bool mmu_t::stlb_lookup(const mem_access_info_t& access_info, reg_t* paddr)
+{
+  reg_t vaddr = access_info.vaddr;
+  uint32_t ctx = stlb_context(access_info);
+
+  stlb_entry_t* set = &stlb[((vaddr >> PGSHIFT) & (stlb_sets - 1)) * stlb_ways];
+  for (size_t i = 0; i < stlb_ways; i++) {
+    auto& e = set[i];
+    if (e.vpn == (vaddr >> PGSHIFT) && e.ctx == ctx && e.epoch == stlb_epoch) {
+      *paddr = vaddr + e.offset;
+      return true;
+    }
+  }
+
+  for (auto& e : stlb_superpages) {
+    if (e.epoch == stlb_epoch && e.vpn == (vaddr >> e.pgshift) && e.ctx == ctx) {
+      *paddr = vaddr + e.offset;
+      return true;
+    }
+  }
+
+  return false;
+}
+
+void mmu_t::stlb_insert(const mem_access_info_t& access_info, reg_t paddr, int pgshift)
+{
+  reg_t vaddr = access_info.vaddr;
+  stlb_entry_t entry = {vaddr >> pgshift, paddr - vaddr, stlb_epoch,
+                        stlb_context(access_info), uint32_t(pgshift)};
+
+  if (pgshift > PGSHIFT) {
+    stlb_superpages[stlb_superpage_victim++ % STLB_SUPERPAGES] = entry;
+  } else {
+    size_t set = (vaddr >> PGSHIFT) & (stlb_sets - 1);
+    stlb[set * stlb_ways + stlb_victim[set]++ % stlb_ways] = entry;
+  }
+}
+
 void throw_access_exception(bool virt, reg_t addr, access_type type)
 {
   switch (type) {
@@ -62,7 +145,13 @@ reg_t mmu_t::translate(mem_access_info_t access_info, reg_t len)
   bool virt = access_info.effective_virt;
   reg_t mode = (reg_t) access_info.effective_priv;
 
-  reg_t paddr = walk(access_info) | (addr & (PGSIZE-1));
+  reg_t paddr;
+  if (stlb.empty() || !stlb_lookup(access_info, &paddr)) {
+    int pgshift;
+    paddr = walk(access_info, &pgshift) | (addr & (PGSIZE-1));
+    if (!stlb.empty() && pgshift)
+      stlb_insert(access_info, paddr, pgshift);
+  }
   if (!pmp_ok(paddr, len, type, mode))
     throw_access_exception(virt, addr, type);
   return paddr;
@@ -196,6 +285,8 @@ void mmu_t::load_slow_path_intrapage(reg_t len, uint8_t* bytes, mem_access_info_
   if (!access_info.flags.is_special_access() && vpn == (tlb_load_tag[vpn % TLB_ENTRIES] & ~TLB_CHECK_TRIGGERS)) {
     auto host_addr = tlb_data[vpn % TLB_ENTRIES].host_offset + addr;
     memcpy(bytes, host_addr, len);
+    if (tracing)
+      trace(tlb_data[vpn % TLB_ENTRIES].target_offset + addr, len, LOAD);
     return;
   }
 
@@ -207,9 +298,9 @@ void mmu_t::load_slow_path_intrapage(reg_t len, uint8_t* bytes, mem_access_info_
 
   if (auto host_addr = sim->addr_to_mem(paddr)) {
     memcpy(bytes, host_addr, len);
-    if (tracer.interested_in_range(paddr, paddr + PGSIZE, LOAD))
-      tracer.trace(paddr, len, LOAD);
-    else if (!access_info.flags.is_special_access())
+    if (tracing)
+      trace(paddr, len, LOAD);
+    if (!access_info.flags.is_special_access())
       refill_tlb(addr, paddr, host_addr, LOAD);
 
   } else if (!mmio_load(paddr, len, bytes)) {
@@ -218,6 +309,8 @@ void mmu_t::load_slow_path_intrapage(reg_t len, uint8_t* bytes, mem_access_info_
 
   if (access_info.flags.lr) {
     load_reservation_address = paddr;
+    load_reservation_value = 0;
+    memcpy(&load_reservation_value, bytes, len);
   }
 }
 
@@ -258,6 +351,8 @@ void mmu_t::store_slow_path_intrapage(reg_t len, const uint8_t* bytes, mem_acces
     if (actually_store) {
       auto host_addr = tlb_data[vpn % TLB_ENTRIES].host_offset + addr;
       memcpy(host_addr, bytes, len);
+      if (tracing)
+        trace(tlb_data[vpn % TLB_ENTRIES].target_offset + addr, len, STORE);
     }
     return;
   }
@@ -267,9 +362,9 @@ void mmu_t::store_slow_path_intrapage(reg_t len, const uint8_t* bytes, mem_acces
   if (actually_store) {
     if (auto host_addr = sim->addr_to_mem(paddr)) {
       memcpy(host_addr, bytes, len);
-      if (tracer.interested_in_range(paddr, paddr + PGSIZE, STORE))
-        tracer.trace(paddr, len, STORE);
-      else if (!access_info.flags.is_special_access())
+      if (tracing)
+        trace(paddr, len, STORE);
+      if (!access_info.flags.is_special_access())
         refill_tlb(addr, paddr, host_addr, STORE);
     } else if (!mmio_store(paddr, len, bytes)) {
       throw trap_store_access_fault(access_info.effective_virt, addr, 0, 0);
@@ -340,36 +435,78 @@ tlb_entry_t mmu_t::refill_tlb(reg_t vaddr, reg_t paddr, char* host_addr, access_
   return entry;
 }
 
-bool mmu_t::pmp_ok(reg_t addr, reg_t len, access_type type, reg_t mode)
+void mmu_t::build_pmp_map()
 {
-  if (!proc || proc->n_pmp == 0)
-    return true;
-
+  // Every entry's range starts and ends on a 4-byte boundary, so the entry
+  // that matches the 4-byte sector at each boundary takes effect all the way
+  // up to the next one.
+  std::vector<reg_t> bounds(1, 0);
   for (size_t i = 0; i < proc->n_pmp; i++) {
-    // Check each 4-byte sector of the access
-    bool any_match = false;
-    bool all_match = true;
-    for (reg_t offset = 0; offset < len; offset += 1 << PMP_SHIFT) {
-      reg_t cur_addr = addr + offset;
-      bool match = proc->state.pmpaddr[i]->match4(cur_addr);
-      any_match |= match;
-      all_match &= match;
-    }
-
-    if (any_match) {
-      // If the PMP matches only a strict subset of the access, fail it
-      if (!all_match)
-        return false;
-
-      return proc->state.pmpaddr[i]->access_ok(type, mode);
+    reg_t base, last;
+    if (proc->state.pmpaddr[i]->match_range(&base, &last)) {
+      bounds.push_back(base);
+      if (last != reg_t(-1))
+        bounds.push_back(last + 1);
     }
   }
+  std::sort(bounds.begin(), bounds.end());
+  bounds.erase(std::unique(bounds.begin(), bounds.end()), bounds.end());
 
   // in case matching region is not found
   const bool mseccfg_mml = proc->state.mseccfg->get_mml();
   const bool mseccfg_mmwp = proc->state.mseccfg->get_mmwp();
-  return ((mode == PRV_M) && !mseccfg_mmwp
-          && (!mseccfg_mml || ((type == LOAD) || (type == STORE))));
+  uint8_t default_perms = 0;
+  if (!mseccfg_mmwp) {
+    default_perms |= 1 << pmp_perm_bit(LOAD, PRV_M);
+    default_perms |= 1 << pmp_perm_bit(STORE, PRV_M);
+    if (!mseccfg_mml)
+      default_perms |= 1 << pmp_perm_bit(FETCH, PRV_M);
+  }
+
+  pmp_map.clear();
+  for (reg_t base : bounds) {
+    pmp_region_t region = {base, -1, default_perms};
+    for (size_t i = 0; i < proc->n_pmp; i++) {
+      auto& entry = proc->state.pmpaddr[i];
+      if (entry->match4(base)) {
+        region.entry = i;
+        region.perms = 0;
+        for (access_type type : {LOAD, STORE, FETCH})
+          for (reg_t mode : {PRV_U, PRV_M})
+            region.perms |= entry->access_ok(type, mode) << pmp_perm_bit(type, mode);
+        break;
+      }
+    }
+
+    if (pmp_map.empty() || pmp_map.back().entry != region.entry)
+      pmp_map.push_back(region);
+  }
+
+  pmp_map_valid = true;
+}
+
+std::vector<mmu_t::pmp_region_t>::const_iterator mmu_t::find_pmp_region(reg_t addr)
+{
+  if (!pmp_map_valid)
+    build_pmp_map();
+
+  return std::upper_bound(pmp_map.cbegin(), pmp_map.cend(), addr,
+    [](reg_t a, const pmp_region_t& r) { return a < r.base; }) - 1;
+}
+
+bool mmu_t::pmp_ok(reg_t addr, reg_t len, access_type type, reg_t mode)
+{
+  if (!proc || proc->n_pmp == 0)
+    return true;
+
+  // Each 4-byte sector of the access must fall in the same region, or else
+  // some entry matches only a strict subset of it and the access fails.
+  auto region = find_pmp_region(addr);
+  reg_t last = addr + ((len - 1) & ~reg_t((1 << PMP_SHIFT) - 1));
+  if (region + 1 != pmp_map.cend() && region[1].base <= last)
+    return false;
+
+  return (region->perms >> pmp_perm_bit(type, mode)) & 1;
 }
 
 reg_t mmu_t::pmp_homogeneous(reg_t addr, reg_t len)
@@ -377,14 +514,38 @@ reg_t mmu_t::pmp_homogeneous(reg_t addr, reg_t len)
   if ((addr | len) & (len - 1))
     abort();
 
-  if (!proc)
+  if (!proc || proc->n_pmp == 0)
     return true;
 
-  for (size_t i = 0; i < proc->n_pmp; i++)
-    if (proc->state.pmpaddr[i]->subset_match(addr, len))
-      return false;
+  auto region = find_pmp_region(addr);
+  return region + 1 == pmp_map.cend() || region[1].base > addr + len - 1;
+}
 
-  return true;
+reg_t mmu_t::pte_load_cached(reg_t table_addr, bool guest_physical, reg_t gva, bool virt,
+                             access_type trap_type, size_t ptesize, reg_t* pte_paddr)
+{
+  reg_t tag = ((table_addr >> PGSHIFT) << 1) | guest_physical;
+  reg_t offset = table_addr & (PGSIZE - 1);
+  pwc_entry_t* entry = &pwc[(table_addr >> PGSHIFT) % PWC_ENTRIES];
+
+  if (entry->tag == tag && entry->epoch == pwc_epoch) {
+    *pte_paddr = entry->paddr + offset;
+    if (ptesize == 4)
+      return from_target(*(target_endian<uint32_t>*)(entry->host_addr + offset));
+    return from_target(*(target_endian<uint64_t>*)(entry->host_addr + offset));
+  }
+
+  *pte_paddr = s2xlate(gva, table_addr, LOAD, trap_type, guest_physical, false);
+  reg_t pte = pte_load(*pte_paddr, gva, virt, trap_type, ptesize);
+
+  // pte_load passed the PMP check, so it holds for the whole page if no PMP
+  // region boundary falls inside it.
+  reg_t page = *pte_paddr - offset;
+  char* host_addr = sim->addr_to_mem(page);
+  if (host_addr && pmp_homogeneous(page, PGSIZE))
+    *entry = {tag, page, host_addr, pwc_epoch};
+
+  return pte;
 }
 
 reg_t mmu_t::s2xlate(reg_t gva, reg_t gpa, access_type type, access_type trap_type, bool virt, bool hlvx)
@@ -409,8 +570,8 @@ reg_t mmu_t::s2xlate(reg_t gva, reg_t gpa, access_type type, access_type trap_ty
       reg_t idx = (gpa >> (PGSHIFT + ptshift)) & ((reg_t(1) << idxbits) - 1);
 
       // check that physical address of PTE is legal
-      auto pte_paddr = base + idx * vm.ptesize;
-      reg_t pte = pte_load(pte_paddr, gva, virt, trap_type, vm.ptesize);
+      reg_t pte_paddr;
+      reg_t pte = pte_load_cached(base + idx * vm.ptesize, false, gva, virt, trap_type, vm.ptesize, &pte_paddr);
       reg_t ppn = (pte & ~reg_t(PTE_ATTR)) >> PTE_PPN_SHIFT;
       bool pbmte = proc->get_state()->menvcfg->read() & MENVCFG_PBMTE;
       bool hade = proc->get_state()->menvcfg->read() & MENVCFG_HADE;
@@ -473,7 +634,7 @@ reg_t mmu_t::s2xlate(reg_t gva, reg_t gpa, access_type type, access_type trap_ty
   }
 }
 
-reg_t mmu_t::walk(mem_access_info_t access_info)
+reg_t mmu_t::walk(mem_access_info_t access_info, int* pgshift)
 {
   access_type type = access_info.type;
   reg_t addr = access_info.vaddr;
@@ -483,6 +644,9 @@ reg_t mmu_t::walk(mem_access_info_t access_info)
   reg_t page_mask = (reg_t(1) << PGSHIFT) - 1;
   reg_t satp = proc->get_state()->satp->readvirt(virt);
   vm_info vm = decode_vm_info(proc->get_const_xlen(), false, mode, satp);
+  // Guest-physical pages may be smaller than guest-virtual ones, so two-stage
+  // translations are only cached a page at a time.
+  *pgshift = virt ? PGSHIFT : 0;
   if (vm.levels == 0)
     return s2xlate(addr, addr & ((reg_t(2) << (proc->xlen-1))-1), type, type, virt, hlvx) & ~page_mask; // zero-extend from xlen
 
@@ -503,8 +667,8 @@ reg_t mmu_t::walk(mem_access_info_t access_info)
     reg_t idx = (addr >> (PGSHIFT + ptshift)) & ((1 << vm.idxbits) - 1);
 
     // check that physical address of PTE is legal
-    auto pte_paddr = s2xlate(addr, base + idx * vm.ptesize, LOAD, type, virt, false);
-    reg_t pte = pte_load(pte_paddr, addr, virt, type, vm.ptesize);
+    reg_t pte_paddr;
+    reg_t pte = pte_load_cached(base + idx * vm.ptesize, virt, addr, virt, type, vm.ptesize, &pte_paddr);
     reg_t ppn = (pte & ~reg_t(PTE_ATTR)) >> PTE_PPN_SHIFT;
     bool pbmte = virt ? (proc->get_state()->henvcfg->read() & HENVCFG_PBMTE) : (proc->get_state()->menvcfg->read() & MENVCFG_PBMTE);
     bool hade = virt ? (proc->get_state()->henvcfg->read() & HENVCFG_HADE) : (proc->get_state()->menvcfg->read() & MENVCFG_HADE);
@@ -555,6 +719,8 @@ reg_t mmu_t::walk(mem_access_info_t access_info)
                         | (vpn & ((reg_t(1) << napot_bits) - 1))
                         | (vpn & ((reg_t(1) << ptshift) - 1))) << PGSHIFT;
       reg_t phys = page_base | (addr & page_mask);
+      if (!virt)
+        *pgshift = PGSHIFT + (napot_bits ? napot_bits : ptshift);
       return s2xlate(addr, phys, type, type, virt, hlvx) & ~page_mask;
     }
   }
@@ -569,6 +735,18 @@ reg_t mmu_t::walk(mem_access_info_t access_info)
 
 void mmu_t::register_memtracer(memtracer_t* t)
 {
-  flush_tlb();
+  flush_trace();
   tracer.hook(t);
+  tracing = true;
+  trace_buffer.reserve(TRACE_BUFFER_SIZE);
+  if (proc)
+    proc->select_step_loop();
+}
+
+void mmu_t::flush_trace()
+{
+  for (auto& r : trace_buffer)
+    if (tracer.interested_in_range(r.paddr, r.paddr + r.len, r.type))
+      tracer.trace(r.paddr, r.len, r.type);
+  trace_buffer.clear();
 }
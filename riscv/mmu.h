@@ -27,10 +27,35 @@ struct insn_fetch_t
   insn_t insn;
 };
 
+// Native code for a hot icache block (see jit.h).  Returns the pc to resume
+// at and the number of the block's instructions it retired.
+struct jit_exit_t {
+  reg_t pc;
+  size_t insns;
+};
+typedef jit_exit_t (*jit_func_t)();
+
 struct icache_entry_t {
-  reg_t tag;
-  struct icache_entry_t* next;
   insn_fetch_t data;
+  reg_t npc; // address of the sequentially following instruction
+};
+
+// A straight-line run of instructions starting at tag.  Blocks are decoded
+// lazily: each time execution falls through the last entry, the next
+// instruction is fetched and appended, so a block grows into a superblock
+// spanning not-taken branches.
+struct icache_block_t {
+  static const size_t MAX_INSNS = 16;
+
+  reg_t tag;
+  uint64_t epoch;
+  size_t size;
+  struct icache_block_t* next; // fall-through successor; validate its tag
+  struct icache_block_t* taken; // last taken-branch target; validate its tag
+  jit_func_t jit;
+  uint32_t heat; // times entered, until it is translated
+  icache_entry_t entries[MAX_INSNS];
+  uint64_t hits[MAX_INSNS]; // executions of each entry, for the PC histogram
 };
 
 struct tlb_entry_t {
@@ -102,6 +127,8 @@ public:
 
     if (likely(!xlate_flags.is_special_access() && aligned && tlb_hit)) {
       res = *(target_endian<T>*)(tlb_data[vpn % TLB_ENTRIES].host_offset + addr);
+      if (unlikely(tracing))
+        trace(tlb_data[vpn % TLB_ENTRIES].target_offset + addr, sizeof(T), LOAD);
     } else {
       load_slow_path(addr, sizeof(T), (uint8_t*)&res, xlate_flags);
     }
@@ -144,6 +171,8 @@ public:
 
     if (!xlate_flags.is_special_access() && likely(aligned && tlb_hit)) {
       *(target_endian<T>*)(tlb_data[vpn % TLB_ENTRIES].host_offset + addr) = to_target(val);
+      if (unlikely(tracing))
+        trace(tlb_data[vpn % TLB_ENTRIES].target_offset + addr, sizeof(T), STORE);
     } else {
       target_endian<T> target_val = to_target(val);
       store_slow_path(addr, sizeof(T), (const uint8_t*)&target_val, xlate_flags, true, false);
@@ -182,6 +211,8 @@ public:
     convert_load_traps_to_store_traps({
       store_slow_path(addr, sizeof(T), nullptr, {false, false, false}, false, true);
       auto lhs = load<T>(addr);
+      if (unlikely(is_parallel()))
+        return amo_atomic<T>(addr, lhs, f);
       store<T>(addr, f(lhs));
       return lhs;
     })
@@ -192,6 +223,8 @@ public:
     convert_load_traps_to_store_traps({
       store_slow_path(addr, sizeof(T), nullptr, {false, false, false}, false, true);
       auto lhs = load<T>(addr);
+      if (unlikely(is_parallel()))
+        return amo_atomic<T>(addr, lhs, [&](T old) { return old == comp ? swap : old; });
       if (lhs == comp)
         store<T>(addr, swap);
       return lhs;
@@ -227,8 +260,10 @@ public:
     convert_load_traps_to_store_traps({
       const reg_t paddr = translate(generate_access_info(addr, LOAD, {false, false, false}), 1);
       if (sim->reservable(paddr)) {
-        if (tracer.interested_in_range(paddr, paddr + PGSIZE, LOAD))
+        if (tracer.interested_in_range(paddr, paddr + PGSIZE, LOAD)) {
+          flush_trace();
           tracer.clean_invalidate(paddr, blocksz, clean, inval);
+        }
       } else {
         throw trap_store_access_fault((proc) ? proc->state.v : false, addr, 0, 0);
       }
@@ -259,7 +294,16 @@ public:
   {
     bool have_reservation = check_load_reservation(addr, sizeof(T));
 
-    if (have_reservation)
+    target_endian<T>* host_addr;
+    if (have_reservation && unlikely(is_parallel()) &&
+        (host_addr = (target_endian<T>*)atomic_host_addr(addr, sizeof(T)))) {
+      // Other harts may have stored to the reservation set since the LR.
+      // Succeed only if memory still holds the value the LR returned.
+      target_endian<T> expected, desired = to_target(val);
+      memcpy((void*)&expected, &load_reservation_value, sizeof(T));
+      have_reservation = __atomic_compare_exchange(host_addr, &expected, &desired,
+                                                   false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+    } else if (have_reservation)
       store(addr, val);
 
     yield_load_reservation();
@@ -267,11 +311,49 @@ public:
     return have_reservation;
   }
 
-  static const reg_t ICACHE_ENTRIES = 1024;
+  // True if other harts run concurrently on other host threads, in which
+  // case AMOs and SCs must update memory with host atomics.
+  bool is_parallel()
+  {
+    return proc && proc->get_cfg().parallel;
+  }
+
+  // Finish an AMO whose old value lhs was already loaded, retrying if
+  // another hart changes the location in between.
+  template<typename T, typename op>
+  T amo_atomic(reg_t addr, T lhs, op f) {
+    auto host_addr = (target_endian<T>*)atomic_host_addr(addr, sizeof(T));
+    if constexpr (sizeof(T) <= sizeof(uint64_t)) {
+      if (host_addr) {
+        target_endian<T> expected = to_target(lhs), desired = to_target<T>(f(lhs));
+        while (!__atomic_compare_exchange(host_addr, &expected, &desired,
+                                          false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST)) {
+          lhs = from_target(expected);
+          desired = to_target<T>(f(lhs));
+        }
+        return lhs;
+      }
+    }
+
+    // MMIO accesses are serialized by the simulator, and amocas.q has no
+    // portable 128-bit host equivalent.
+    store<T>(addr, f(lhs));
+    return lhs;
+  }
+
+  // Host address of a naturally aligned location that has already passed
+  // the store permission checks, or NULL if it is not backed by memory.
+  char* atomic_host_addr(reg_t addr, reg_t len)
+  {
+    reg_t paddr = translate(generate_access_info(addr, STORE, {false, false, false}), len);
+    return sim->addr_to_mem(paddr);
+  }
+
+  static const reg_t ICACHE_BLOCKS = 1024;
 
   inline size_t icache_index(reg_t addr)
   {
-    return (addr / PC_ALIGN) % ICACHE_ENTRIES;
+    return (addr / PC_ALIGN) % ICACHE_BLOCKS;
   }
 
   template<typename T>
@@ -280,7 +362,8 @@ public:
     return from_target(*(target_endian<T>*)(tlb_entry.host_offset + addr));
   }
 
-  inline icache_entry_t* refill_icache(reg_t addr, icache_entry_t* entry)
+  // Fetch and decode the instruction at addr into entry.
+  inline void refill_icache_entry(reg_t addr, icache_entry_t* entry)
   {
     if (matched_trigger)
       throw *matched_trigger;
@@ -304,34 +387,118 @@ public:
     }
 
     insn_fetch_t fetch = {proc->decode_insn(insn), insn};
-    entry->tag = addr;
-    entry->next = &icache[icache_index(addr + length)];
     entry->data = fetch;
+    entry->npc = addr + length;
+  }
 
-    reg_t paddr = tlb_entry.target_offset + addr;;
-    if (tracer.interested_in_range(paddr, paddr + 1, FETCH)) {
-      entry->tag = -1;
-      tracer.trace(paddr, length, FETCH);
+  // Start a new block at addr.
+  inline icache_block_t* refill_icache(reg_t addr, icache_block_t* block)
+  {
+    collect_icache_hits(block);
+    block->hits[0] = 0;
+    block->tag = addr;
+    block->epoch = icache_epoch;
+    block->size = 1;
+    block->taken = nullptr;
+    block->jit = nullptr;
+    block->heat = 0;
+    refill_icache_entry(addr, &block->entries[0]);
+    return block;
+  }
+
+  inline icache_block_t* access_icache(reg_t addr)
+  {
+    icache_block_t* block = &icache[icache_index(addr)];
+    if (likely(block->tag == addr && block->epoch == icache_epoch))
+      return block;
+    return refill_icache(addr, block);
+  }
+
+  // Execution fell through the last entry of block to addr.  Append the
+  // instruction at addr if there is room, otherwise follow (or establish)
+  // the link to the successor block.  Returns the block holding addr and
+  // sets *idx to its position within it.
+  inline icache_block_t* icache_fall_through(icache_block_t* block, reg_t addr, size_t* idx)
+  {
+    if (block->size < icache_block_t::MAX_INSNS) {
+      refill_icache_entry(addr, &block->entries[block->size]);
+      block->hits[block->size] = 0;
+      *idx = block->size++;
+      return block;
     }
-    return entry;
+
+    *idx = 0;
+    icache_block_t* next = block->next;
+    if (likely(next && next->tag == addr && next->epoch == icache_epoch))
+      return next;
+    next = access_icache(addr);
+    block->next = next;
+    return next;
+  }
+
+  // Credit the block's execution counts to the PC histogram before its
+  // entries are replaced.
+  inline void collect_icache_hits(icache_block_t* block)
+  {
+    if (likely(!proc || !proc->histogram_enabled))
+      return;
+    reg_t pc = block->tag;
+    for (size_t i = 0; i < block->size; i++) {
+      if (block->hits[i]) {
+        proc->pc_histogram[pc] += block->hits[i];
+        block->hits[i] = 0;
+      }
+      pc = block->entries[i].npc;
+    }
+  }
+
+  // Execution left block through a taken branch or jump to addr.  Follow (or
+  // establish) the link to the block starting there.
+  inline icache_block_t* icache_taken_branch(icache_block_t* block, reg_t addr)
+  {
+    icache_block_t* target = block->taken;
+    if (likely(target && target->tag == addr && target->epoch == icache_epoch))
+      return target;
+    target = access_icache(addr);
+    block->taken = target;
+    return target;
   }
 
-  inline icache_entry_t* access_icache(reg_t addr)
+  // Blocks are only usable until the next icache flush.
+  inline bool icache_block_valid(const icache_block_t* block) const
   {
-    icache_entry_t* entry = &icache[icache_index(addr)];
-    if (likely(entry->tag == addr))
-      return entry;
-    return refill_icache(addr, entry);
+    return block->epoch == icache_epoch;
   }
 
   inline insn_fetch_t load_insn(reg_t addr)
   {
     icache_entry_t entry;
-    return refill_icache(addr, &entry)->data;
+    refill_icache_entry(addr, &entry);
+    if (unlikely(tracing))
+      trace_fetch(addr, entry.data.insn.length());
+    return entry.data;
   }
 
+  // Memory tracers see each access in program order, but the accesses are
+  // recorded here and handed to them in batches, so the TLB and icache stay
+  // in use while tracing.
+  bool is_tracing() const { return tracing; }
+
+  inline void trace_fetch(reg_t addr, reg_t len)
+  {
+    trace(translate_insn_addr(addr).target_offset + addr, len, FETCH);
+  }
+
+  void flush_trace();
+
   void flush_tlb();
+  // Must be called whenever the PMP CSRs change.
+  void flush_pmp() { pmp_map_valid = false; }
+  // Like flush_tlb(), but keeps the second-level TLB, whose entries are
+  // tagged with the privilege mode they were translated for.
+  void flush_tlb_for_privilege_change();
   void flush_icache();
+  void collect_icache_histogram();
 
   void register_memtracer(memtracer_t*);
 
@@ -365,11 +532,31 @@ private:
   processor_t* proc;
   memtracer_list_t tracer;
   reg_t load_reservation_address;
+  uint64_t load_reservation_value; // raw bytes returned by the LR
   uint16_t fetch_temp;
   reg_t blocksz;
 
-  // implement an instruction cache for simulator performance
-  icache_entry_t icache[ICACHE_ENTRIES];
+  // implement an instruction cache for simulator performance.  Flushing
+  // just advances icache_epoch, which invalidates every block at once.
+  icache_block_t icache[ICACHE_BLOCKS];
+  uint64_t icache_epoch;
+
+  // accesses not yet passed to the tracers
+  struct trace_record_t {
+    reg_t paddr;
+    reg_t len;
+    access_type type;
+  };
+  static const size_t TRACE_BUFFER_SIZE = 4096;
+  bool tracing; // !tracer.empty()
+  std::vector<trace_record_t> trace_buffer;
+
+  inline void trace(reg_t paddr, reg_t len, access_type type)
+  {
+    trace_buffer.push_back({paddr, len, type});
+    if (unlikely(trace_buffer.size() == TRACE_BUFFER_SIZE))
+      flush_trace();
+  }
 
   // implement a TLB for simulator performance
   static const reg_t TLB_ENTRIES = 256;
@@ -381,6 +568,45 @@ private:
   reg_t tlb_load_tag[TLB_ENTRIES];
   reg_t tlb_store_tag[TLB_ENTRIES];
 
+  // Optional second-level TLB, consulted before walking the page tables on a
+  // miss above.  Base pages live in a set-associative array; superpages
+  // (including Svnapot ranges) in a small fully associative one.
+  struct stlb_entry_t {
+    reg_t vpn;     // vaddr >> pgshift
+    reg_t offset;  // paddr - vaddr
+    uint64_t epoch;
+    uint32_t ctx;  // see stlb_context()
+    uint32_t pgshift;
+  };
+  static const size_t STLB_SUPERPAGES = 16;
+  size_t stlb_sets;
+  size_t stlb_ways;
+  std::vector<stlb_entry_t> stlb;      // stlb_sets * stlb_ways entries
+  std::vector<uint32_t> stlb_victim;   // next way to replace, per set
+  stlb_entry_t stlb_superpages[STLB_SUPERPAGES];
+  uint32_t stlb_superpage_victim;
+  uint64_t stlb_epoch;
+  bool stlb_lookup(const mem_access_info_t& access_info, reg_t* paddr);
+  void stlb_insert(const mem_access_info_t& access_info, reg_t paddr, int pgshift);
+
+  // Page-walk cache: where recently walked page-table pages live, so a walk
+  // needn't repeat the G-stage translation, PMP check and bus lookup for each
+  // level.  The PTEs themselves are still read on every walk, so stores to
+  // page tables need no tracking; the cache is dropped with the TLB.
+  struct pwc_entry_t {
+    reg_t tag;    // table page number << 1, | 1 if guest-physical
+    reg_t paddr;  // host-physical address of the page
+    char* host_addr;
+    uint64_t epoch;
+  };
+  static const size_t PWC_ENTRIES = 64;
+  pwc_entry_t pwc[PWC_ENTRIES];
+  uint64_t pwc_epoch;
+  // Load the PTE at table_addr, which is guest-physical if guest_physical.
+  // Also returns the PTE's host-physical address for a later pte_store.
+  reg_t pte_load_cached(reg_t table_addr, bool guest_physical, reg_t gva, bool virt,
+                        access_type trap_type, size_t ptesize, reg_t* pte_paddr);
+
   // finish translation on a TLB miss and update the TLB
   tlb_entry_t refill_tlb(reg_t vaddr, reg_t paddr, char* host_addr, access_type type);
   const char* fill_from_mmio(reg_t vaddr, reg_t paddr);
@@ -388,8 +614,10 @@ private:
   // perform a stage2 translation for a given guest address
   reg_t s2xlate(reg_t gva, reg_t gpa, access_type type, access_type trap_type, bool virt, bool hlvx);
 
-  // perform a page table walk for a given VA; set referenced/dirty bits
-  reg_t walk(mem_access_info_t access_info);
+  // perform a page table walk for a given VA; set referenced/dirty bits.
+  // *pgshift gets the log2 size of the region the translation holds for, or
+  // 0 if it's not worth caching.
+  reg_t walk(mem_access_info_t access_info, int* pgshift);
 
   // handle uncommon cases: TLB misses, page faults, MMIO
   tlb_entry_t fetch_slow_path(reg_t addr);
@@ -475,6 +703,24 @@ private:
   reg_t pmp_homogeneous(reg_t addr, reg_t len);
   bool pmp_ok(reg_t addr, reg_t len, access_type type, reg_t mode);
 
+  // The PMP entries split physical memory into regions in which the same
+  // entry (or none) takes effect.  They're kept sorted by base address, with
+  // the outcome of each kind of access precomputed, and are rebuilt on the
+  // first check after a PMP CSR write.
+  struct pmp_region_t {
+    reg_t base;     // the region extends up to the next one's base
+    int entry;      // the lowest-numbered matching entry, or -1
+    uint8_t perms;  // bit pmp_perm_bit(type, mode) is set if allowed
+  };
+  std::vector<pmp_region_t> pmp_map;
+  bool pmp_map_valid;
+  static unsigned pmp_perm_bit(access_type type, reg_t mode)
+  {
+    return type + 3 * (mode == PRV_M);
+  }
+  void build_pmp_map();
+  std::vector<pmp_region_t>::const_iterator find_pmp_region(reg_t addr);
+
 #ifdef RISCV_ENABLE_DUAL_ENDIAN
   bool target_big_endian;
 #else
@@ -487,6 +733,7 @@ private:
   triggers::matched_t *matched_trigger;
 
   friend class processor_t;
+  friend class jit_t;
 };
 
 struct vm_info {
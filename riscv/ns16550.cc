@@ -321,6 +321,13 @@ void ns16550_t::tick(reg_t UNUSED rtc_ticks)
   update_interrupt();
 }
 
+reg_t ns16550_t::ticks_until_event()
+{
+  // Received bytes keep the interrupt raised until they are read.  Input from
+  // the terminal isn't predictable, so it's only polled at each tick.
+  return rx_queue.empty() ? reg_t(-1) : 0;
+}
+
 std::string ns16550_generate_dts(const sim_t* sim)
 {
   std::stringstream s;
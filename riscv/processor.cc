@@ -8,6 +8,7 @@
 #include "decode_macros.h"
 #include "simif.h"
 #include "mmu.h"
+#include "jit.h"
 #include "disasm.h"
 #include "platform.h"
 #include "vector_unit.h"
@@ -35,7 +36,7 @@ processor_t::processor_t(const isa_parser_t *isa, const cfg_t *cfg,
   : debug(false), halt_request(HR_NONE), isa(isa), cfg(cfg), sim(sim), id(id), xlen(0),
   histogram_enabled(false), log_commits_enabled(false),
   log_file(log_file), sout_(sout_.rdbuf()), halt_on_reset(halt_on_reset),
-  in_wfi(false), check_triggers_icount(false),
+  in_wfi(false), check_triggers_icount(false), pending_trap(NULL),
   impl_table(256, false), extension_enable_table(isa->get_extension_table()),
   last_pc(1), executions(1), TM(cfg->trigger_count)
 {
@@ -58,6 +59,7 @@ processor_t::processor_t(const isa_parser_t *isa, const cfg_t *cfg,
 
   register_base_instructions();
   mmu = new mmu_t(sim, cfg->endianness, this);
+  jit = cfg->jit ? new jit_t(this) : NULL;
 
   disassembler = new disassembler_t(isa);
   for (auto e : isa->get_extensions())
@@ -81,6 +83,7 @@ processor_t::~processor_t()
 {
   if (histogram_enabled)
   {
+    mmu->collect_icache_histogram();
     std::vector<std::pair<reg_t, uint64_t>> ordered_histo(pc_histogram.begin(), pc_histogram.end());
     std::sort(ordered_histo.begin(), ordered_histo.end(),
               [](auto& lhs, auto& rhs) { return lhs.second < rhs.second; });
@@ -90,6 +93,7 @@ processor_t::~processor_t()
       fprintf(stderr, "%0" PRIx64 " %" PRIu64 "\n", it.first, it.second);
   }
 
+  delete jit;
   delete mmu;
   delete disassembler;
 }
@@ -545,11 +549,21 @@ void processor_t::set_debug(bool value)
 void processor_t::set_histogram(bool value)
 {
   histogram_enabled = value;
+  select_step_loop();
 }
 
 void processor_t::enable_log_commits()
 {
   log_commits_enabled = true;
+  mmu->flush_icache(); // cached decodes use the unlogged handlers
+  select_step_loop();
+}
+
+void processor_t::retire_idle(reg_t rounds)
+{
+  // Each step() from WFI retires it once more; see processor_t::step().
+  state.minstret->bump(rounds);
+  state.mcycle->bump(rounds);
 }
 
 void processor_t::reset()
@@ -560,6 +574,7 @@ void processor_t::reset()
   halt_on_reset = false;
   VU.reset();
   in_wfi = false;
+  select_step_loop();
 
   if (n_pmp > 0) {
     // For backwards compatibility with software that is unaware of PMP,
@@ -603,6 +618,7 @@ void processor_t::set_pmp_num(reg_t n)
     abort();
   }
   n_pmp = n;
+  mmu->flush_pmp();
 }
 
 void processor_t::set_pmp_granularity(reg_t gran)
@@ -615,6 +631,7 @@ void processor_t::set_pmp_granularity(reg_t gran)
   }
 
   lg_pmp_granularity = ctz(gran);
+  mmu->flush_pmp();
 }
 
 void processor_t::set_mmu_capability(int cap)
@@ -721,7 +738,7 @@ reg_t processor_t::legalize_privilege(reg_t prv)
 
 void processor_t::set_privilege(reg_t prv, bool virt)
 {
-  mmu->flush_tlb();
+  mmu->flush_tlb_for_privilege_change();
   state.prev_prv = state.prv;
   state.prev_v = state.v;
   state.prv = legalize_privilege(prv);
@@ -967,44 +984,17 @@ reg_t processor_t::get_csr(int which, insn_t insn, bool write, bool peek)
   throw trap_illegal_instruction(insn.bits());
 }
 
-reg_t illegal_instruction(processor_t UNUSED *p, insn_t insn, reg_t UNUSED pc)
+reg_t illegal_instruction(processor_t *p, insn_t insn, reg_t pc)
 {
   // The illegal instruction can be longer than ILEN bits, where the tval will
   // contain the first ILEN bits of the faulting instruction. We hard-code the
   // ILEN to 32 bits since all official instructions have at most 32 bits.
-  throw trap_illegal_instruction(insn.bits() & 0xffffffffULL);
+  raise_trap(trap_illegal_instruction(insn.bits() & 0xffffffffULL));
 }
 
 insn_func_t processor_t::decode_insn(insn_t insn)
 {
-  // look up opcode in hash table
-  size_t idx = insn.bits() % OPCODE_CACHE_SIZE;
-  insn_desc_t desc = opcode_cache[idx];
-
-  bool rve = extension_enabled('E');
-
-  if (unlikely(insn.bits() != desc.match)) {
-    // fall back to linear search
-    int cnt = 0;
-    insn_desc_t* p = &instructions[0];
-    while ((insn.bits() & p->mask) != p->match)
-      p++, cnt++;
-    desc = *p;
-
-    if (p->mask != 0 && p > &instructions[0]) {
-      if (p->match != (p - 1)->match && p->match != (p + 1)->match) {
-        // move to front of opcode list to reduce miss penalty
-        while (--p >= &instructions[0])
-          *(p + 1) = *p;
-        instructions[0] = desc;
-      }
-    }
-
-    opcode_cache[idx] = desc;
-    opcode_cache[idx].match = insn.bits();
-  }
-
-  return desc.func(xlen, rve, log_commits_enabled);
+  return decode_tree.lookup(insn.bits())->*insn_variant;
 }
 
 void processor_t::register_insn(insn_desc_t desc)
@@ -1026,8 +1016,10 @@ void processor_t::build_opcode_map()
   };
   std::sort(instructions.begin(), instructions.end(), cmp());
 
-  for (size_t i = 0; i < OPCODE_CACHE_SIZE; i++)
-    opcode_cache[i] = insn_desc_t::illegal();
+  std::vector<decode_tree_t<const insn_desc_t*>::pattern_t> patterns;
+  for (auto& insn : instructions)
+    patterns.push_back({insn.match, insn.mask, &insn});
+  decode_tree.build(patterns, nullptr);
 }
 
 void processor_t::register_extension(extension_t* x)
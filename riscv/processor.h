@@ -3,6 +3,7 @@
 #define _RISCV_PROCESSOR_H
 
 #include "decode.h"
+#include "decode_tree.h"
 #include "trap.h"
 #include "abstract_device.h"
 #include <string>
@@ -10,6 +11,7 @@
 #include <unordered_map>
 #include <map>
 #include <cassert>
+#include <new>
 #include "debug_rom_defines.h"
 #include "entropy_source.h"
 #include "csrs.h"
@@ -22,6 +24,7 @@
 
 class processor_t;
 class mmu_t;
+class jit_t;
 typedef reg_t (*insn_func_t)(processor_t*, insn_t, reg_t);
 class simif_t;
 class trap_t;
@@ -43,18 +46,25 @@ struct insn_desc_t
   insn_func_t logged_rv32e;
   insn_func_t logged_rv64e;
 
-  insn_func_t func(int xlen, bool rve, bool logged)
+  typedef insn_func_t insn_desc_t::*variant_t;
+
+  static variant_t variant(int xlen, bool rve, bool logged)
   {
     if (logged)
       if (rve)
-        return xlen == 64 ? logged_rv64e : logged_rv32e;
+        return xlen == 64 ? &insn_desc_t::logged_rv64e : &insn_desc_t::logged_rv32e;
       else
-        return xlen == 64 ? logged_rv64i : logged_rv32i;
+        return xlen == 64 ? &insn_desc_t::logged_rv64i : &insn_desc_t::logged_rv32i;
     else
       if (rve)
-        return xlen == 64 ? fast_rv64e : fast_rv32e;
+        return xlen == 64 ? &insn_desc_t::fast_rv64e : &insn_desc_t::fast_rv32e;
       else
-        return xlen == 64 ? fast_rv64i : fast_rv32i;
+        return xlen == 64 ? &insn_desc_t::fast_rv64i : &insn_desc_t::fast_rv32i;
+  }
+
+  insn_func_t func(int xlen, bool rve, bool logged)
+  {
+    return this->*variant(xlen, rve, logged);
   }
 
   static insn_desc_t illegal()
@@ -204,6 +214,9 @@ public:
   bool get_log_commits_enabled() const { return log_commits_enabled; }
   void reset();
   void step(size_t n); // run for n cycles
+  // Pick the step loop and instruction handlers for the current XLEN, RVE
+  // and logging modes.  Called whenever one of them may have changed.
+  void select_step_loop();
   void put_csr(int which, reg_t val);
   uint32_t get_id() const { return id; }
   reg_t get_csr(int which, insn_t insn, bool write, bool peek = 0);
@@ -304,6 +317,26 @@ public:
 
   void clear_waiting_for_interrupt() { in_wfi = false; };
   bool is_waiting_for_interrupt() { return in_wfi; };
+  // True if the hart is in WFI and will stay there until an interrupt.
+  bool is_idle()
+  {
+    return in_wfi && !state.debug_mode && halt_request == HR_NONE &&
+           !state.dcsr->halt && state.single_step == state.STEP_NONE &&
+           !check_triggers_icount && !(state.mip->read() & state.mie->read());
+  }
+  // Account for `rounds` calls to step() while is_idle().
+  void retire_idle(reg_t rounds);
+
+  // Record a synchronous trap raised by the instruction at epc.  The
+  // instruction handler then returns PC_TRAP, and step() takes the trap
+  // without unwinding the stack.
+  template<class T> void set_pending_trap(const T& t, reg_t epc)
+  {
+    static_assert(sizeof(T) <= sizeof(pending_trap_storage) &&
+                  alignof(T) <= alignof(mem_trap_t), "trap too large");
+    pending_trap = new (pending_trap_storage) T(t);
+    pending_trap_pc = epc;
+  }
 
 private:
   const isa_parser_t * const isa;
@@ -311,6 +344,7 @@ private:
 
   simif_t* sim;
   mmu_t* mmu; // main memory is always accessed via the mmu
+  jit_t* jit; // NULL unless hot blocks are translated to host code
   std::unordered_map<std::string, extension_t*> custom_extensions;
   disassembler_t* disassembler;
   state_t state;
@@ -323,6 +357,9 @@ private:
   bool halt_on_reset;
   bool in_wfi;
   bool check_triggers_icount;
+  trap_t* pending_trap; // points into pending_trap_storage, or NULL
+  reg_t pending_trap_pc;
+  alignas(mem_trap_t) uint8_t pending_trap_storage[sizeof(mem_trap_t)];
   std::vector<bool> impl_table;
 
   // Note: does not include single-letter extensions in misa
@@ -330,15 +367,14 @@ private:
   std::bitset<NUM_ISA_EXTENSIONS> extension_dynamic;
   mutable std::bitset<NUM_ISA_EXTENSIONS> extension_assumed_const;
 
-  std::vector<insn_desc_t> instructions;
+  std::vector<insn_desc_t> instructions; // in decode priority order
+  decode_tree_t<const insn_desc_t*> decode_tree;
   std::unordered_map<reg_t,uint64_t> pc_histogram;
 
-  static const size_t OPCODE_CACHE_SIZE = 8191;
-  insn_desc_t opcode_cache[OPCODE_CACHE_SIZE];
-
   void take_pending_interrupt() { take_interrupt(state.mip->read() & state.mie->read()); }
   void take_interrupt(reg_t mask); // take first enabled interrupt in mask
   void take_trap(trap_t& t, reg_t epc); // take an exception
+  void deliver_trap(trap_t& t, reg_t epc); // take_trap, then any trigger or single-step
   void take_trigger_action(triggers::action_t action, reg_t breakpoint_tval, reg_t epc, bool virt);
   void disasm(insn_t insn); // disassemble and print an instruction
   int paddr_bits();
@@ -358,6 +394,10 @@ private:
   void register_base_instructions();
   insn_func_t decode_insn(insn_t insn);
 
+  template<bool logged, bool use_jit> void step_loop(size_t n);
+  void (processor_t::*step_loop_func)(size_t n);
+  insn_desc_t::variant_t insn_variant;
+
   // Track repeated executions for processor_t::disasm()
   uint64_t last_pc, last_bits, executions;
 public:
@@ -31,6 +31,7 @@ static void handle_signal(int sig)
 }
 
 const size_t sim_t::INTERLEAVE;
+const size_t sim_t::MAX_IDLE_SKIP;
 
 extern device_factory_t* clint_factory;
 extern device_factory_t* plic_factory;
@@ -56,6 +57,11 @@ sim_t::sim_t(const cfg_t *cfg, bool halted,
     sout_(nullptr),
     current_step(0),
     current_proc(0),
+    parallel_epoch(0),
+    parallel_steps(0),
+    parallel_pending(0),
+    parallel_rtc_carry(0),
+    parallel_exit(false),
     debug(false),
     histogram_enabled(false),
     log(false),
@@ -239,6 +245,16 @@ sim_t::sim_t(const cfg_t *cfg, bool halted,
 
 sim_t::~sim_t()
 {
+  if (!workers.empty()) {
+    {
+      std::lock_guard<std::mutex> lock(parallel_mutex);
+      parallel_exit = true;
+    }
+    parallel_start.notify_all();
+    for (auto& worker : workers)
+      worker.join();
+  }
+
   for (size_t i = 0; i < procs.size(); i++)
     delete procs[i];
   delete debug_mmu;
@@ -277,6 +293,85 @@ void sim_t::step(size_t n)
   }
 }
 
+// If every hart is waiting for an interrupt, fast-forward over the scheduling
+// rounds in which no device can wake one of them, and return true.  Skipped
+// rounds look exactly as if they had been run: each hart retires its WFI
+// again, and the devices see the same number of RTC ticks.
+bool sim_t::skip_idle_rounds()
+{
+  if (current_proc != 0 || current_step != 0)
+    return false;
+
+  for (auto p : procs) {
+    if (!p->is_idle())
+      return false;
+  }
+
+  reg_t ticks = reg_t(-1);
+  for (auto &dev : devices)
+    ticks = std::min(ticks, dev->ticks_until_event());
+  if (ticks == 0 || ticks == reg_t(-1))
+    return false;
+
+  const reg_t rtc_ticks = INTERLEAVE / INSNS_PER_RTC_TICK;
+  reg_t rounds = std::min<reg_t>((ticks - 1) / rtc_ticks, MAX_IDLE_SKIP);
+  if (rounds == 0)
+    return false;
+
+  for (auto p : procs) {
+    p->retire_idle(rounds);
+    p->get_mmu()->yield_load_reservation();
+  }
+  for (auto &dev : devices) dev->tick(rounds * rtc_ticks);
+  return true;
+}
+
+void sim_t::step_parallel(size_t n)
+{
+  if (workers.empty()) {
+    for (size_t i = 0; i < procs.size(); i++)
+      workers.emplace_back(&sim_t::parallel_worker, this, i);
+  }
+
+  {
+    std::unique_lock<std::mutex> lock(parallel_mutex);
+    parallel_steps = n;
+    parallel_pending = procs.size();
+    parallel_epoch++;
+    parallel_start.notify_all();
+    parallel_done.wait(lock, [this] { return parallel_pending == 0; });
+  }
+
+  // All harts are parked at the barrier, so devices can be ticked and
+  // inspected (e.g. by htif) without further synchronization.
+  parallel_rtc_carry += n;
+  reg_t rtc_ticks = parallel_rtc_carry / INSNS_PER_RTC_TICK;
+  parallel_rtc_carry %= INSNS_PER_RTC_TICK;
+  for (auto &dev : devices) dev->tick(rtc_ticks);
+}
+
+void sim_t::parallel_worker(size_t id)
+{
+  uint64_t epoch = 0;
+  while (true) {
+    size_t n;
+    {
+      std::unique_lock<std::mutex> lock(parallel_mutex);
+      parallel_start.wait(lock, [&] { return parallel_exit || parallel_epoch != epoch; });
+      if (parallel_exit)
+        return;
+      epoch = parallel_epoch;
+      n = parallel_steps;
+    }
+
+    procs[id]->step(n);
+
+    std::lock_guard<std::mutex> lock(parallel_mutex);
+    if (--parallel_pending == 0)
+      parallel_done.notify_one();
+  }
+}
+
 void sim_t::set_debug(bool value)
 {
   debug = value;
@@ -317,6 +412,7 @@ bool sim_t::mmio_load(reg_t paddr, size_t len, uint8_t* bytes)
 {
   if (paddr + len < paddr || !paddr_ok(paddr + len - 1))
     return false;
+  std::lock_guard<std::recursive_mutex> lock(mmio_mutex);
   return bus.load(paddr, len, bytes);
 }
 
@@ -324,6 +420,7 @@ bool sim_t::mmio_store(reg_t paddr, size_t len, const uint8_t* bytes)
 {
   if (paddr + len < paddr || !paddr_ok(paddr + len - 1))
     return false;
+  std::lock_guard<std::recursive_mutex> lock(mmio_mutex);
   return bus.store(paddr, len, bytes);
 }
 
@@ -376,8 +473,8 @@ void sim_t::set_rom()
 char* sim_t::addr_to_mem(reg_t paddr) {
   if (!paddr_ok(paddr))
     return NULL;
-  auto desc = bus.find_device(paddr);
-  if (auto mem = dynamic_cast<mem_t*>(desc.second))
+  auto desc = bus.find_mem(paddr);
+  if (auto mem = desc.second)
     if (paddr - desc.first < mem->size())
       return mem->contents(paddr - desc.first);
   return NULL;
@@ -403,7 +500,9 @@ void sim_t::idle()
 
   if (debug || ctrlc_pressed)
     interactive();
-  else
+  else if (cfg->parallel)
+    step_parallel(cfg->quantum);
+  else if (!cfg->idle_skip || !skip_idle_rounds())
     step(INTERLEAVE);
 
   if (remote_bitbang)
@@ -15,6 +15,9 @@
 #include <map>
 #include <string>
 #include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
 #include <sys/types.h>
 
 class mmu_t;
@@ -63,6 +66,7 @@ public:
   static const size_t INTERLEAVE = 5000;
   static const size_t INSNS_PER_RTC_TICK = 100; // 10 MHz clock for 1 BIPS core
   static const size_t CPU_HZ = 1000000000; // 1GHz CPU
+  static const size_t MAX_IDLE_SKIP = CPU_HZ / INTERLEAVE; // rounds, i.e. 1 second
 
 private:
   isa_parser_t isa;
@@ -87,8 +91,26 @@ private:
 
   processor_t* get_core(const std::string& i);
   void step(size_t n); // step through simulation
+  void step_parallel(size_t n); // step every hart n times, concurrently
+  void parallel_worker(size_t id);
+  bool skip_idle_rounds();
   size_t current_step;
   size_t current_proc;
+
+  // With cfg->parallel, each hart runs on its own host thread.  The harts
+  // are released together for one quantum, and devices are ticked once all
+  // of them have finished it.
+  std::vector<std::thread> workers;
+  std::mutex parallel_mutex;
+  std::condition_variable parallel_start;
+  std::condition_variable parallel_done;
+  uint64_t parallel_epoch;
+  size_t parallel_steps;
+  size_t parallel_pending;
+  size_t parallel_rtc_carry;
+  bool parallel_exit;
+  // serializes device accesses, which may come from several hart threads
+  std::recursive_mutex mmio_mutex;
   bool debug;
   bool histogram_enabled; // provide a histogram of PCs
   bool log;
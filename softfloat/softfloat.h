@@ -50,8 +50,16 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include <stdint.h>
 #include "softfloat_types.h"
 
+/*----------------------------------------------------------------------------
+| Spike may run harts on separate host threads, each with its own rounding
+| mode and exception flags.
+*----------------------------------------------------------------------------*/
 #ifndef THREAD_LOCAL
-#define THREAD_LOCAL
+#ifdef __cplusplus
+#define THREAD_LOCAL thread_local
+#else
+#define THREAD_LOCAL _Thread_local
+#endif
 #endif
 
 #ifdef __cplusplus
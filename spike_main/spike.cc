@@ -4,6 +4,7 @@
 #include "cfg.h"
 #include "sim.h"
 #include "mmu.h"
+#include "jit.h"
 #include "arith.h"
 #include "remote_bitbang.h"
 #include "cachesim.h"
@@ -67,6 +68,11 @@ static void help(int exit_code = 1)
           DEFAULT_KERNEL_BOOTARGS);
   fprintf(stderr, "  --real-time-clint     Increment clint time at real-time rate\n");
   fprintf(stderr, "  --triggers=<n>        Number of supported triggers [default 4]\n");
+  fprintf(stderr, "  --parallel            Run each hart on its own host thread\n");
+  fprintf(stderr, "  --quantum=<n>         Instructions per hart between --parallel barriers [default 5000]\n");
+  fprintf(stderr, "  --jit                 Translate hot RV64 code to x86-64 host code\n");
+  fprintf(stderr, "  --idle-skip           Skip ahead to the next timer interrupt when all harts are in WFI\n");
+  fprintf(stderr, "  --tlb=<sets>:<ways>   Add a second-level TLB of this geometry [default none]\n");
   fprintf(stderr, "  --dm-progsize=<words> Progsize for the debug module [default 2]\n");
   fprintf(stderr, "  --dm-sba=<bits>       Debug system bus access supports up to "
       "<bits> wide accesses [default 0]\n");
@@ -418,6 +424,25 @@ int main(int argc, char** argv)
   parser.option(0, "bootargs", 1, [&](const char* s){cfg.bootargs = s;});
   parser.option(0, "real-time-clint", 0, [&](const char UNUSED *s){cfg.real_time_clint = true;});
   parser.option(0, "triggers", 1, [&](const char *s){cfg.trigger_count = atoul_safe(s);});
+  parser.option(0, "parallel", 0, [&](const char UNUSED *s){cfg.parallel = true;});
+  parser.option(0, "quantum", 1, [&](const char *s){cfg.quantum = atoul_nonzero_safe(s);});
+  parser.option(0, "jit", 0, [&](const char UNUSED *s){
+    if (!jit_t::host_supported()) {
+      fprintf(stderr, "--jit is only supported on x86-64 hosts\n");
+      exit(1);
+    }
+    cfg.jit = true;
+  });
+  parser.option(0, "idle-skip", 0, [&](const char UNUSED *s){cfg.idle_skip = true;});
+  parser.option(0, "tlb", 1, [&](const char *s){
+    char* ways;
+    cfg.stlb_sets = strtoul(s, &ways, 0);
+    if (*ways != ':' || (cfg.stlb_ways = strtoul(ways + 1, &ways, 0)) == 0 || *ways ||
+        cfg.stlb_sets == 0 || (cfg.stlb_sets & (cfg.stlb_sets - 1))) {
+      fprintf(stderr, "--tlb expects <sets>:<ways>, with a power-of-2 number of sets\n");
+      exit(1);
+    }
+  });
   parser.option(0, "extlib", 1, [&](const char *s){
     void *lib = dlopen(s, RTLD_NOW | RTLD_GLOBAL);
     if (lib == NULL) {
@@ -473,6 +498,11 @@ int main(int argc, char** argv)
   if (!*argv1)
     help();
 
+  if (cfg.parallel && (debug || histogram || log || log_commits || ic || dc || l2)) {
+    fprintf(stderr, "--parallel can't be combined with -d, -g, -l, --log-commits, --ic, --dc or --l2\n");
+    exit(1);
+  }
+
   std::vector<std::pair<reg_t, mem_t*>> mems = make_mems(cfg.mem_layout());
 
   if (kernel && check_file_exists(kernel)) {